@@ -0,0 +1,637 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <deb/deb-downloader.hpp>
+#include <deb/service.hpp>
+
+#include "repo-server.hpp"
+#include "synthetic-repo.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+	double secondsSince(Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); }
+
+	// Results are sections of named numbers, written as a two level JSON object.
+	class Report {
+	public:
+		void set(const string& section, const string& key, double value) {
+			stringstream ss;
+			ss << value;
+			entry(section, key) = ss.str();
+		}
+		void set(const string& section, const string& key, const string& value) {
+			entry(section, key) = "\"" + value + "\"";
+		}
+
+		string json() {
+			stringstream ss;
+			ss << "{\n";
+			for (size_t s = 0; s < sections.size(); s++) {
+				ss << "  \"" << sections[s].first << "\": {";
+				auto& values = sections[s].second;
+				for (size_t v = 0; v < values.size(); v++) {
+					ss << (v ? ", " : "") << "\"" << values[v].first << "\": " << values[v].second;
+				}
+				ss << "}" << (s + 1 < sections.size() ? "," : "") << "\n";
+			}
+			ss << "}\n";
+			return ss.str();
+		}
+
+	private:
+		vector<pair<string, vector<pair<string, string>>>> sections;
+
+		string& entry(const string& section, const string& key) {
+			auto it = find_if(sections.begin(), sections.end(), [&](auto& s) { return s.first == section; });
+			if (it == sections.end()) it = sections.insert(sections.end(), {section, {}});
+			it->second.push_back({key, ""});
+			return it->second.back().second;
+		}
+	};
+
+	struct Options {
+		bench::RepoConfig repo;
+		size_t roots = 10;
+		// the parser runs on an index of its own, about the size of a distribution's main component
+		size_t parserStanzas = 60000;
+		size_t bytesPerSecond = 0;
+		size_t dropEvery = 0;
+		size_t stallEvery = 25;
+		size_t stallMs = 300;
+		// caps of the budget_* runs, one at a time
+		uint64_t budgetBytes = 4 << 20;
+		uint64_t budgetMemory = 16 << 20;
+		uint64_t budgetBandwidth = 50 << 20;
+		size_t repeat = 3;
+		bool micro = true;
+		bool install = true;
+		// resolves every alternative, Recommends and Suggests again to report what the filtering saved
+		bool dependencySavings = false;
+		string json = "bench-results.json";
+	};
+
+	Options parseOptions(int argc, char** argv) {
+		Options o;
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			auto value = [&]() -> string {
+				if (i + 1 >= argc) throw runtime_error("missing value for " + arg);
+				return argv[++i];
+			};
+			if (arg == "--packages") o.repo.packages = stoull(value());
+			else if (arg == "--fanout")
+				o.repo.fanOut = stoull(value());
+			else if (arg == "--deb-size")
+				o.repo.debSize = stoull(value());
+			else if (arg == "--files")
+				o.repo.filesPerDeb = stoull(value());
+			else if (arg == "--codec")
+				o.repo.codec = value();
+			else if (arg == "--seed")
+				o.repo.seed = stoull(value());
+			else if (arg == "--roots")
+				o.roots = stoull(value());
+			else if (arg == "--parser-stanzas")
+				o.parserStanzas = stoull(value());
+			else if (arg == "--throttle")
+				o.bytesPerSecond = stoull(value());
+			else if (arg == "--drop-every")
+				o.dropEvery = stoull(value());
+			else if (arg == "--stall-every")
+				o.stallEvery = stoull(value());
+			else if (arg == "--stall-ms")
+				o.stallMs = stoull(value());
+			else if (arg == "--budget-bytes")
+				o.budgetBytes = stoull(value());
+			else if (arg == "--budget-memory")
+				o.budgetMemory = stoull(value());
+			else if (arg == "--budget-bandwidth")
+				o.budgetBandwidth = stoull(value());
+			else if (arg == "--repeat")
+				o.repeat = stoull(value());
+			else if (arg == "--no-micro")
+				o.micro = false;
+			else if (arg == "--no-install")
+				o.install = false;
+			else if (arg == "--dependency-savings")
+				o.dependencySavings = true;
+			else if (arg == "--json")
+				o.json = value();
+			else {
+				cerr << "usage: bench [--packages N] [--fanout N] [--deb-size BYTES] [--files N] [--codec xz|zst|gz|none]\n"
+						"             [--seed N] [--roots N] [--parser-stanzas N] [--throttle BYTES_PER_SEC]\n"
+						"             [--drop-every N] [--repeat N] [--stall-every N] [--stall-ms MS]\n"
+						"             [--budget-bytes BYTES] [--budget-memory BYTES] [--budget-bandwidth BYTES_PER_S]\n"
+						"             [--no-micro] [--no-install] [--dependency-savings] [--json FILE]\n";
+				exit(arg == "--help" ? 0 : 1);
+			}
+		}
+		o.roots = std::min(o.roots, o.repo.packages);
+		return o;
+	}
+
+	// Best of `repeat` runs, the least disturbed one is the most comparable across changes.
+	template <typename F>
+	double best(size_t repeat, F run) {
+		double result = 1e300;
+		for (size_t i = 0; i < std::max<size_t>(repeat, 1); i++) {
+			auto start = Clock::now();
+			run();
+			result = std::min(result, secondsSince(start));
+		}
+		return result;
+	}
+
+	// Peak resident set growth over everything `run` allocates, best effort like Budget::resetPeakRss().
+	template <typename F>
+	uint64_t peakRssGrowth(F run) {
+		deb::Budget::resetPeakRss();
+		uint64_t before = deb::Budget::peakRss();
+		run();
+		uint64_t peak = deb::Budget::peakRss();
+		return peak > before ? peak - before : 0;
+	}
+
+	void benchParser(Options& o, Report& report) {
+		bench::RepoConfig config = o.repo;
+		config.packages = o.parserStanzas;
+		const string text = bench::SyntheticRepo::packagesIndex(config);
+		report.set("config", "parser_stanzas", o.parserStanzas);
+
+		// both paths look up what fetchPackageList needs from every stanza
+		size_t stanzas = 0;
+		double t;
+		uint64_t rss = peakRssGrowth([&] {
+			t = best(o.repeat, [&] {
+				stanzas = 0;
+				deb::PackagesParser parser([&](std::string_view stanza) {
+					if (!deb::findField(stanza, "Package").empty() && !deb::findField(stanza, "Filename").empty())
+						stanzas++;
+				});
+				for (size_t pos = 0; pos < text.size(); pos += 1 << 16)
+					parser.feed(text.data() + pos, std::min<size_t>(1 << 16, text.size() - pos));
+				parser.finish();
+			});
+		});
+		report.set("parser", "seconds", t);
+		report.set("parser", "mb_per_second", text.size() / t / 1e6);
+		report.set("parser", "stanzas_per_second", stanzas / t);
+		report.set("parser", "peak_rss_growth_bytes", rss);
+
+		// the regex path the parser replaced: the whole text split on blank lines, then each stanza searched
+		size_t matched = 0;
+		rss = peakRssGrowth([&] {
+			t = best(o.repeat, [&] {
+				static const boost::regex blankLine("\n\n", boost::regex::optimize);
+				static const boost::regex package("Package:\\s?([^\\r\\n]*)", boost::regex::optimize);
+				static const boost::regex filename("Filename:\\s?([^\\r\\n]*)", boost::regex::optimize);
+				boost::sregex_token_iterator first{text.begin(), text.end(), blankLine, -1}, last;
+				vector<string> entries{first, last};
+				matched = 0;
+				for (auto& entry : entries) {
+					boost::smatch matches;
+					if (boost::regex_search(entry, matches, package) && boost::regex_search(entry, matches, filename))
+						matched++;
+				}
+			});
+		});
+		report.set("parser_regex_baseline", "seconds", t);
+		report.set("parser_regex_baseline", "mb_per_second", text.size() / t / 1e6);
+		report.set("parser_regex_baseline", "stanzas_per_second", matched / t);
+		report.set("parser_regex_baseline", "peak_rss_growth_bytes", rss);
+
+		size_t memory = 0;
+		t = best(o.repeat, [&] {
+			deb::PackageIndex index;
+			uint32_t prefix = index.addPrefix("http://bench");
+			deb::PackagesParser parser([&](std::string_view stanza) { index.addStanza(prefix, stanza); });
+			parser.feed(text.data(), text.size());
+			parser.finish();
+			memory = index.memoryUsage();
+		});
+		report.set("index_build", "seconds", t);
+		report.set("index_build", "stanzas_per_second", stanzas / t);
+		report.set("index_build", "memory_bytes", memory);
+
+		// Depends fields alone: owned strings per alternative, views, and compiling them to package ids
+		deb::PackageIndex index;
+		uint32_t prefix = index.addPrefix("http://bench");
+		deb::PackagesParser parser([&](std::string_view stanza) { index.addStanza(prefix, stanza); });
+		parser.feed(text.data(), text.size());
+		parser.finish();
+		size_t alternatives = 0;
+		t = best(o.repeat, [&] {
+			alternatives = 0;
+			for (size_t i = 0; i < index.packagesSize(); i++)
+				for (auto& group : deb::parseDependencies(index.str(index.package(i).depends)))
+					alternatives += group.size();
+		});
+		report.set("dependency_parse_strings", "seconds", t);
+		report.set("dependency_parse_strings", "alternatives_per_second", alternatives / t);
+		t = best(o.repeat, [&] {
+			alternatives = 0;
+			for (size_t i = 0; i < index.packagesSize(); i++)
+				deb::forEachDependency(index.str(index.package(i).depends), [&](auto&) { alternatives++; });
+		});
+		report.set("dependency_parse_views", "seconds", t);
+		report.set("dependency_parse_views", "alternatives_per_second", alternatives / t);
+		t = best(o.repeat, [&] {
+			deb::DependencyGraph graph(index);
+			for (uint32_t i = 0; i < index.packagesSize(); i++)
+				graph.forEachGroup(i, deb::DependencyGraph::Depends, [](auto, auto) {});
+			memory = graph.memoryUsage();
+		});
+		report.set("dependency_graph", "seconds", t);
+		report.set("dependency_graph", "alternatives_per_second", alternatives / t);
+		report.set("dependency_graph", "memory_bytes", memory);
+	}
+
+	void benchCodec(bench::SyntheticRepo& repo, Options& o, Report& report) {
+		uint64_t compressed = 0, raw = 0;
+		for (auto& tar : repo.dataTars) compressed += tar.size();
+		for (auto& tar : repo.rawTars) raw += tar.size();
+
+		string member = "data.tar" + bench::codecExtension(o.repo.codec);
+		size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+		std::vector<char> sink(1 << 16);
+		for (size_t decodeThreads : {size_t(1), threads}) {
+			double t = best(o.repeat, [&] {
+				for (auto& tar : repo.dataTars) {
+					deb::imemstream in(tar);
+					deb::DecompressStream decompressed(in, member, decodeThreads);
+					while (decompressed.read(sink.data(), sink.size()) || decompressed.gcount() > 0) {}
+				}
+			});
+			string section = "decompress_" + o.repo.codec + "_" + to_string(decodeThreads) + "t";
+			report.set(section, "seconds", t);
+			report.set(section, "compressed_bytes", compressed);
+			report.set(section, "mb_per_second", raw / t / 1e6);
+		}
+	}
+
+	void benchExtract(bench::SyntheticRepo& repo, Options& o, Report& report, const fs::path& work) {
+		double t = best(o.repeat, [&] {
+			fs::remove_all(work / "extract");
+			fs::create_directories(work / "extract");
+			for (auto& tar : repo.rawTars) {
+				deb::imemstream in(tar);
+				tar::Reader reader(in);
+				reader.throwOnUnsupported = false;
+				reader.extractPath("./", (work / "extract").string());
+			}
+		});
+		report.set("extract", "seconds", t);
+		report.set("extract", "files_per_second", repo.rawTars.size() * o.repo.filesPerDeb / t);
+		report.set("extract", "mb_per_second", repo.payloadBytes / t / 1e6);
+		fs::remove_all(work / "extract");
+
+		// a package of many small headers, where creating files costs more than decompressing them
+		const size_t smallFiles = 20000;
+		bench::TarWriter writer;
+		for (size_t d = 0; d < smallFiles / 100; d++) {
+			writer.directory("./usr/include/d" + to_string(d) + "/");
+			for (size_t f = 0; f < 100; f++)
+				writer.file("./usr/include/d" + to_string(d) + "/f" + to_string(f) + ".h", string(300, 'a' + f % 26));
+		}
+		string smallTar = writer.finish();
+		for (size_t threads : {0, 4}) {
+			string run = threads ? "extract_small_files_writers" : "extract_small_files_inline";
+			double t = best(o.repeat, [&] {
+				fs::remove_all(work / "extract");
+				fs::create_directories(work / "extract");
+				deb::Installer inst(nullptr);
+				inst.writerThreads = threads;
+				deb::imemstream in(smallTar);
+				inst.extractTarIncremental(in, "headers", "headers 1", {{"./", (work / "extract").string()}});
+			});
+			report.set(run, "seconds", t);
+			report.set(run, "files_per_second", smallFiles / t);
+		}
+		fs::remove_all(work / "extract");
+	}
+
+	// Workers hammering their own progress entries while the renderer snapshots, what a big install does to the tracker.
+	// Also run without a renderer, the difference is what drawing costs the workers.
+	void benchProgress(Options& o, Report& report) {
+		size_t threads = std::max<size_t>(2, std::thread::hardware_concurrency());
+		const size_t packagesPerThread = 2000, updatesPerPackage = 64;
+		double withoutRenderer = 0;
+		for (bool rendering : {false, true}) {
+			string section = rendering ? "progress_renderer" : "progress_no_renderer";
+			size_t snapshots = 0;
+			double t = best(o.repeat, [&] {
+				deb::ProgressTracker tracker;
+				std::unique_ptr<deb::ProgressRenderer> renderer;
+				if (rendering)
+					renderer = std::make_unique<deb::ProgressRenderer>(
+						tracker, [&](auto&) { snapshots++; }, std::chrono::milliseconds(1)
+					);
+				vector<thread> workers;
+				for (size_t w = 0; w < threads; w++) {
+					workers.emplace_back([&, w] {
+						for (size_t p = 0; p < packagesPerThread; p++) {
+							auto entry = tracker.begin("pkg" + to_string(w) + "-" + to_string(p), updatesPerPackage);
+							for (size_t u = 0; u < updatesPerPackage; u++) entry->bytes++;
+							tracker.end(entry);
+						}
+					});
+				}
+				for (auto& w : workers) w.join();
+			});
+			report.set(section, "seconds", t);
+			report.set(section, "packages_per_second", threads * packagesPerThread / t);
+			if (!rendering) withoutRenderer = t;
+			if (rendering) {
+				report.set(section, "snapshots", snapshots);
+				report.set(section, "slowdown", t / withoutRenderer);
+			}
+		}
+	}
+
+	void stageDelta(
+		Report& report,
+		const string& section,
+		const vector<deb::Scheduler::StageStats>& before,
+		const vector<deb::Scheduler::StageStats>& after
+	) {
+		for (size_t i = 0; i < after.size(); i++) {
+			double busy = after[i].busySeconds - before[i].busySeconds;
+			if (busy > 0) report.set(section, string(after[i].name) + "_busy_seconds", busy);
+		}
+	}
+
+	void benchInstall(bench::SyntheticRepo& repo, Options& o, Report& report, const fs::path& work) {
+		bench::RepoServer server(repo.files);
+		server.bytesPerSecond = o.bytesPerSecond;
+		server.dropEvery = o.dropEvery;
+
+		string roots;
+		vector<string> rootList;
+		for (size_t i = 0; i < o.roots; i++) {
+			rootList.push_back(bench::SyntheticRepo::packageName(i));
+			roots += rootList.back() + " ";
+		}
+
+		for (bool streaming : {true, false}) {
+			string section = streaming ? "install_streaming" : "install_buffered";
+			fs::remove_all(work / "root");
+			deb::Installer inst(nullptr);
+			inst.setSources({"deb " + server.url() + " " + o.repo.distribution + " " + o.repo.component});
+			inst.architecture = o.repo.architecture;
+			inst.liveView = false;
+			inst.streamingInstall = streaming;
+			inst.reportDependencySavings = o.dependencySavings;
+
+			auto start = Clock::now();
+			inst.getPackageList();
+			report.set(section, "index_seconds", secondsSince(start));
+
+			start = Clock::now();
+			auto plan = inst.resolve(rootList, inst.recursionLimit);
+			report.set(section, "resolve_seconds", secondsSince(start));
+			report.set(section, "packages", plan.size());
+
+			auto before = inst.pipeline().stats();
+			start = Clock::now();
+			inst.install(roots, (work / "root").string());
+			report.set(section, "install_seconds", secondsSince(start));
+			stageDelta(report, section, before, inst.pipeline().stats());
+			report.set(section, "http_requests", inst.connectionPool.requests());
+			report.set(section, "http_connections", inst.connectionPool.connections());
+			if (o.dependencySavings) {
+				report.set(section, "selected_bytes", inst.lastResolution.bytes);
+				report.set(section, "unfiltered_packages", inst.lastResolution.unfilteredPackages);
+				report.set(section, "unfiltered_bytes", inst.lastResolution.unfilteredBytes);
+			}
+		}
+
+		// second run against a warm index cache, what an unchanged daily refresh costs
+		fs::remove_all(work / "index-cache");
+		for (string run : {"index_cold_cache", "index_warm_cache"}) {
+			deb::Installer inst(nullptr);
+			inst.setSources({"deb " + server.url() + " " + o.repo.distribution + " " + o.repo.component});
+			inst.architecture = o.repo.architecture;
+			inst.indexCacheDirectory = work / "index-cache";
+			uint64_t sent = server.bytesSent();
+			auto start = Clock::now();
+			inst.getPackageList();
+			report.set(run, "seconds", secondsSince(start));
+			report.set(run, "bytes_transferred", server.bytesSent() - sent);
+		}
+
+		// the same repository as a directory on disk, indexes and .debs are mapped instead of downloaded
+		{
+			for (auto& [path, body] : repo.files) {
+				fs::create_directories((work / "local-repo" / path).parent_path());
+				std::ofstream(work / "local-repo" / path, std::ios::binary) << body;
+			}
+			fs::remove_all(work / "root");
+			deb::Installer inst(nullptr);
+			inst.setSources({"deb file://" + (work / "local-repo").string() + " " + o.repo.distribution + " " +
+							 o.repo.component});
+			inst.architecture = o.repo.architecture;
+			inst.liveView = false;
+			auto start = Clock::now();
+			inst.getPackageList();
+			report.set("install_local", "index_seconds", secondsSince(start));
+			start = Clock::now();
+			inst.install(roots, (work / "root").string());
+			report.set("install_local", "install_seconds", secondsSince(start));
+		}
+
+		// a pinned install reads the lockfile of an earlier one and starts downloading right away
+		{
+			deb::Installer inst(nullptr);
+			inst.setSources({"deb " + server.url() + " " + o.repo.distribution + " " + o.repo.component});
+			inst.architecture = o.repo.architecture;
+			inst.liveView = false;
+			inst.resolveLockfile({{roots, {{"./", (work / "root").string()}}}}).save(work / "deb.lock");
+		}
+		for (bool incremental : {false, true}) {
+			string run = incremental ? "install_lockfile_unchanged" : "install_lockfile";
+			if (!incremental) fs::remove_all(work / "root");
+			deb::Installer inst(nullptr);
+			inst.liveView = false;
+			size_t requests = server.requests();
+			auto start = Clock::now();
+			inst.install(deb::Lockfile::load(work / "deb.lock"));
+			report.set(run, "seconds", secondsSince(start));
+			report.set(run, "http_requests", server.requests() - requests);
+		}
+
+		report.set("server", "requests", server.requests());
+		report.set("server", "dropped", server.dropped());
+		report.set("server", "bytes_sent", server.bytesSent());
+	}
+
+	// Two servers with the same repository, the first one stalls every stallEvery-th request. Compares sticking to it,
+	// picking the faster mirror per download, and picking plus hedging.
+	void benchMirrors(bench::SyntheticRepo& repo, Options& o, Report& report, const fs::path& work) {
+		string roots;
+		for (size_t i = 0; i < o.roots; i++) roots += bench::SyntheticRepo::packageName(i) + " ";
+
+		for (string run : {"mirrors_single", "mirrors_fastest", "mirrors_hedged"}) {
+			bench::RepoServer stalling(repo.files), steady(repo.files);
+			stalling.stallEvery = o.stallEvery;
+			stalling.stallLatency = std::chrono::milliseconds(o.stallMs);
+			steady.latency = std::chrono::milliseconds(2);
+
+			fs::remove_all(work / "root");
+			deb::Installer inst(nullptr);
+			vector<string> sources = {"deb " + stalling.url() + " " + o.repo.distribution + " " + o.repo.component};
+			if (run != "mirrors_single")
+				sources.push_back("deb " + steady.url() + " " + o.repo.distribution + " " + o.repo.component);
+			inst.setSources(sources);
+			inst.architecture = o.repo.architecture;
+			inst.liveView = false;
+			inst.mirrors.hedge = run == "mirrors_hedged";
+
+			inst.getPackageList();
+			auto start = Clock::now();
+			inst.install(roots, (work / "root").string());
+			report.set(run, "install_seconds", secondsSince(start));
+			report.set(run, "mirror_groups", inst.mirrors.allGroups().size());
+			report.set(run, "hedges", inst.mirrors.hedges());
+			report.set(run, "hedge_wins", inst.mirrors.hedgeWins());
+			report.set(run, "stalling_requests", stalling.requests());
+			report.set(run, "steady_requests", steady.requests());
+		}
+	}
+
+	// Index fetch and install from scratch with no budget and under each cap on its own, peak RSS is reset per run.
+	void benchBudget(bench::SyntheticRepo& repo, Options& o, Report& report, const fs::path& work) {
+		string roots;
+		for (size_t i = 0; i < o.roots; i++) roots += bench::SyntheticRepo::packageName(i) + " ";
+
+		bench::RepoServer server(repo.files);
+		for (string run : {"budget_unlimited", "budget_in_flight", "budget_memory", "budget_bandwidth"}) {
+			fs::remove_all(work / "root");
+			deb::Budget::resetPeakRss();
+			deb::Installer inst(nullptr);
+			inst.setSources({"deb " + server.url() + " " + o.repo.distribution + " " + o.repo.component});
+			inst.architecture = o.repo.architecture;
+			inst.liveView = false;
+			if (run == "budget_in_flight") inst.budget.maxInFlightBytes = o.budgetBytes;
+			if (run == "budget_memory") inst.budget.maxMemoryBytes = o.budgetMemory;
+			if (run == "budget_bandwidth") inst.budget.maxBytesPerSecond = o.budgetBandwidth;
+
+			auto start = Clock::now();
+			inst.getPackageList();
+			inst.install(roots, (work / "root").string());
+			auto stats = inst.budget.stats();
+			report.set(run, "seconds", secondsSince(start));
+			report.set(run, "peak_rss_bytes", stats.peakRss);
+			report.set(run, "bytes_per_second", stats.bytesPerSecond);
+			report.set(run, "peak_in_flight_bytes", stats.peakInFlightBytes);
+			report.set(run, "peak_memory_bytes", stats.peakMemoryBytes);
+			report.set(run, "queued", stats.queued);
+		}
+	}
+
+	// One package lookup through a fresh Installer, against lookups and resolutions answered by a running service.
+	void benchService(bench::SyntheticRepo& repo, Options& o, Report& report, const fs::path& work) {
+		bench::RepoServer server(repo.files);
+		string source = "deb " + server.url() + " " + o.repo.distribution + " " + o.repo.component;
+		string name = bench::SyntheticRepo::packageName(0);
+		double t = best(o.repeat, [&] {
+			deb::Installer inst(nullptr);
+			inst.setSources({source});
+			inst.architecture = o.repo.architecture;
+			inst.getPackageList();
+			if (inst.packageIndex.url(name).empty()) throw runtime_error("no url for " + name);
+		});
+		report.set("service", "fresh_installer_lookup_seconds", t);
+
+		deb::InstallerService service;
+		service.installer.setSources({source});
+		service.installer.architecture = o.repo.architecture;
+		service.refreshInterval = std::chrono::seconds(0);
+		auto start = Clock::now();
+		service.start(work / "service.sock");
+		report.set("service", "start_seconds", secondsSince(start));
+
+		deb::ServiceClient client(work / "service.sock");
+		const size_t lookups = 10000, resolutions = 1000;
+		start = Clock::now();
+		for (size_t i = 0; i < lookups; i++)
+			client.request("provides " + bench::SyntheticRepo::packageName(i % o.repo.packages));
+		report.set("service", "provides_microseconds", secondsSince(start) / lookups * 1e6);
+		start = Clock::now();
+		for (size_t i = 0; i < resolutions; i++)
+			client.request("resolve " + bench::SyntheticRepo::packageName(i % o.repo.packages));
+		report.set("service", "resolve_microseconds", secondsSince(start) / resolutions * 1e6);
+		start = Clock::now();
+		client.request("refresh");
+		report.set("service", "refresh_seconds", secondsSince(start));
+		service.stop();
+	}
+};// namespace
+
+int main(int argc, char** argv) {
+	Options o = parseOptions(argc, argv);
+	Report report;
+	fs::path work = fs::temp_directory_path() / ("deb-bench-" + to_string(getpid()));
+	fs::create_directories(work);
+
+	report.set("config", "packages", o.repo.packages);
+	report.set("config", "fanout", o.repo.fanOut);
+	report.set("config", "deb_size", o.repo.debSize);
+	report.set("config", "files_per_deb", o.repo.filesPerDeb);
+	report.set("config", "codec", o.repo.codec);
+	report.set("config", "roots", o.roots);
+	report.set("config", "hardware_threads", std::thread::hardware_concurrency());
+
+	auto start = Clock::now();
+	bench::SyntheticRepo repo(o.repo);
+	report.set("generate", "seconds", secondsSince(start));
+	report.set("generate", "payload_bytes", repo.payloadBytes);
+
+	if (o.micro) {
+		benchParser(o, report);
+		benchCodec(repo, o, report);
+		benchExtract(repo, o, report, work);
+		benchProgress(o, report);
+	}
+	if (o.install) {
+		benchInstall(repo, o, report, work);
+		benchMirrors(repo, o, report, work);
+		benchBudget(repo, o, report, work);
+		benchService(repo, o, report, work);
+	}
+
+	fs::remove_all(work);
+	string json = report.json();
+	std::ofstream(o.json) << json;
+	std::cout << json;
+	return 0;
+}
@@ -0,0 +1,137 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <httplib.h>
+
+namespace bench {
+	// Serves a file map over http on a free localhost port. Range requests are answered by httplib, every file has
+	// an ETag and If-None-Match is answered with a bodiless 304.
+	// Optionally paces every response and cuts every dropEvery-th body off halfway, to exercise resume and retries.
+	// latency delays every response, stallLatency every stallEvery-th one on top, to give mirrors a latency tail.
+	class RepoServer {
+	public:
+		size_t bytesPerSecond = 0;// 0 = unthrottled
+		size_t dropEvery = 0;// 0 = never drop
+		std::chrono::milliseconds latency{0};
+		size_t stallEvery = 0;// 0 = never stall
+		std::chrono::milliseconds stallLatency{0};
+
+		RepoServer(const std::map<std::string, std::string>& files) : files(files) {
+			server.Get(R"(/(.*))", [this](const httplib::Request& req, httplib::Response& res) { serve(req, res); });
+			port = server.bind_to_any_port("127.0.0.1");
+			if (port < 0) throw std::runtime_error("could not bind the benchmark server");
+			thread = std::thread([this] { server.listen_after_bind(); });
+		}
+		RepoServer(const RepoServer&) = delete;
+		~RepoServer() {
+			server.stop();
+			thread.join();
+		}
+
+		std::string url() { return "http://127.0.0.1:" + std::to_string(port); }
+
+		size_t requests() { return requestCount; }
+		size_t dropped() { return droppedCount; }
+		size_t notModified() { return notModifiedCount; }
+		// connections the server accepted and read a request from, told apart by the client's address and port
+		size_t connections() {
+			std::lock_guard<std::mutex> lock(peersMtx);
+			return peers.size();
+		}
+		uint64_t bytesSent() { return sentBytes; }
+
+	private:
+		const std::map<std::string, std::string>& files;
+		httplib::Server server;
+		std::thread thread;
+		int port = -1;
+		std::atomic_size_t requestCount{0};
+		std::atomic_size_t droppedCount{0};
+		std::atomic_size_t notModifiedCount{0};
+		std::mutex peersMtx;
+		std::set<std::pair<std::string, int>> peers;
+		std::atomic_uint64_t sentBytes{0};
+
+		void serve(const httplib::Request& req, httplib::Response& res) {
+			auto it = files.find(req.matches[1]);
+			if (it == files.end()) {
+				res.status = 404;
+				return;
+			}
+			const std::string& body = it->second;
+			size_t request = ++requestCount;
+			{
+				std::lock_guard<std::mutex> lock(peersMtx);
+				peers.emplace(req.remote_addr, req.remote_port);
+			}
+			auto etag = "\"" + std::to_string(std::hash<std::string>()(body)) + "\"";
+			res.set_header("ETag", etag);
+			if (req.get_header_value("If-None-Match") == etag) {
+				notModifiedCount++;
+				res.status = 304;
+				return;
+			}
+			bool drop = dropEvery > 0 && request % dropEvery == 0;
+			auto delay = latency + (stallEvery > 0 && request % stallEvery == 0 ? stallLatency : std::chrono::milliseconds(0));
+			if (delay.count() > 0) std::this_thread::sleep_for(delay);
+
+			res.set_content_provider(
+				body.size(),
+				"application/octet-stream",
+				[this, &body, drop, sent = size_t(0), total = size_t(0)](
+					size_t offset, size_t length, httplib::DataSink& sink
+				) mutable {
+					size_t chunk = std::min<size_t>(length, 64 << 10);
+					// the first call asks for the whole (remaining) range, a dropped response dies halfway through it
+					if (total == 0) total = length;
+					if (drop && sent >= total / 2) {
+						droppedCount++;
+						return false;
+					}
+					if (bytesPerSecond > 0)
+						std::this_thread::sleep_for(std::chrono::microseconds(chunk * 1000000 / bytesPerSecond));
+					sink.write(body.data() + offset, chunk);
+					sent += chunk;
+					sentBytes += chunk;
+					return true;
+				}
+			);
+		}
+	};
+};// namespace bench
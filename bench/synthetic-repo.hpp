@@ -0,0 +1,265 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <lzma.h>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <zstd.h>
+
+#include <deb/sha256.hpp>
+
+namespace bench {
+	struct RepoConfig {
+		size_t packages = 1000;
+		size_t fanOut = 3;// Depends entries per package, every fourth one is an alternative group
+		size_t debSize = 64 << 10;// uncompressed payload per package
+		size_t filesPerDeb = 8;
+		std::string codec = "xz";// data.tar codec: xz, zst, gz or none
+		uint64_t seed = 1;
+		std::string distribution = "bench";
+		std::string component = "main";
+		std::string architecture = "binary-amd64";
+	};
+
+	inline std::string compress(const std::string& codec, const std::string& data) {
+		if (codec == "none") return data;
+		std::string out;
+		if (codec == "xz") {
+			out.resize(lzma_stream_buffer_bound(data.size()));
+			size_t written = 0;
+			if (lzma_easy_buffer_encode(
+					1, LZMA_CHECK_CRC64, nullptr, (const uint8_t*)data.data(), data.size(), (uint8_t*)out.data(), &written,
+					out.size()
+				) != LZMA_OK)
+				throw std::runtime_error("xz compression failed");
+			out.resize(written);
+		} else if (codec == "zst") {
+			out.resize(ZSTD_compressBound(data.size()));
+			size_t written = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), 3);
+			if (ZSTD_isError(written)) throw std::runtime_error("zstd compression failed");
+			out.resize(written);
+		} else if (codec == "gz") {
+			z_stream strm;
+			std::memset(&strm, 0, sizeof(strm));
+			// 16 + max window bits asks zlib for a gzip wrapper
+			if (deflateInit2(&strm, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				throw std::runtime_error("gzip compression failed");
+			out.resize(deflateBound(&strm, data.size()) + 32);
+			strm.next_in = (Bytef*)data.data();
+			strm.avail_in = data.size();
+			strm.next_out = (Bytef*)out.data();
+			strm.avail_out = out.size();
+			int ret = deflate(&strm, Z_FINISH);
+			deflateEnd(&strm);
+			if (ret != Z_STREAM_END) throw std::runtime_error("gzip compression failed");
+			out.resize(strm.total_out);
+		} else {
+			throw std::runtime_error("unknown codec " + codec);
+		}
+		return out;
+	}
+
+	inline std::string codecExtension(const std::string& codec) { return codec == "none" ? "" : "." + codec; }
+
+	// Minimal ustar writer, enough for the regular files and directories of a generated package.
+	class TarWriter {
+	public:
+		void directory(const std::string& name) { header(name, 0, '5', 0755); }
+
+		void file(const std::string& name, const std::string& content) {
+			header(name, content.size(), '0', 0644);
+			out += content;
+			out.append((512 - content.size() % 512) % 512, '\0');
+		}
+
+		std::string finish() {
+			out.append(1024, '\0');
+			return std::move(out);
+		}
+
+	private:
+		std::string out;
+
+		void header(const std::string& name, size_t size, char type, unsigned mode) {
+			if (name.size() >= 100) throw std::runtime_error("tar name too long: " + name);
+			char h[512];
+			std::memset(h, 0, sizeof(h));
+			std::memcpy(h, name.data(), name.size());
+			snprintf(h + 100, 8, "%07o", mode);
+			snprintf(h + 108, 8, "%07o", 0);
+			snprintf(h + 116, 8, "%07o", 0);
+			snprintf(h + 124, 12, "%011llo", (unsigned long long)size);
+			snprintf(h + 136, 12, "%011o", 0);
+			h[156] = type;
+			std::memcpy(h + 257, "ustar", 6);
+			std::memcpy(h + 263, "00", 2);
+			std::memset(h + 148, ' ', 8);
+			unsigned sum = 0;
+			for (unsigned char c : h) sum += c;
+			snprintf(h + 148, 8, "%06o", sum);
+			out.append(h, sizeof(h));
+		}
+	};
+
+	inline void arMember(std::string& out, const std::string& name, const std::string& content) {
+		char h[61];
+		snprintf(h, sizeof(h), "%-16s%-12s%-6s%-6s%-8s%-10zu`\n", name.c_str(), "0", "0", "0", "100644", content.size());
+		out.append(h, 60);
+		out += content;
+		if (content.size() % 2) out += '\n';
+	}
+
+	// A complete, self consistent apt repository in memory: pool/ with .debs, Packages in every codec
+	// and an unsigned InRelease/Release listing their hashes. Keys are paths relative to the repository root.
+	class SyntheticRepo {
+	public:
+		RepoConfig config;
+		std::map<std::string, std::string> files;
+		std::vector<std::string> dataTars;// compressed data.tar members, for the codec benchmark
+		std::vector<std::string> rawTars;// the same members uncompressed, for the extraction benchmark
+		std::string packagesText;
+		uint64_t payloadBytes = 0;
+
+		SyntheticRepo(RepoConfig config) : config(config) { generate(); }
+
+		static std::string packageName(size_t i) { return "bench-pkg" + std::to_string(i); }
+
+		// Only the Packages text of a repository with config.packages packages, without building a single .deb (sizes
+		// are made up). Lets the parser be measured at the size of a real distribution.
+		static std::string packagesIndex(const RepoConfig& config) {
+			std::mt19937_64 rng(config.seed);
+			std::string text;
+			for (size_t i = 0; i < config.packages; i++) {
+				std::string name = packageName(i);
+				text += stanza(config, i, dependsFor(config, i, rng), config.debSize, deb::Sha256::of(name));
+			}
+			return text;
+		}
+
+		std::string distPath() { return "dists/" + config.distribution; }
+		std::string packagesPath() { return config.component + "/" + config.architecture + "/Packages"; }
+
+	private:
+		void generate() {
+			std::mt19937_64 rng(config.seed);
+			for (size_t i = 0; i < config.packages; i++) {
+				std::string name = packageName(i);
+				std::string deb = buildDeb(name, rng);
+				packagesText += stanza(config, i, dependsFor(config, i, rng), deb.size(), deb::Sha256::of(deb));
+				files[poolPath(config, name)] = std::move(deb);
+			}
+
+			std::string release = "Origin: bench\nSuite: " + config.distribution + "\nSHA256:\n";
+			auto list = [&](const std::string& path, const std::string& content) {
+				release += " " + deb::Sha256::of(content) + " " + std::to_string(content.size()) + " " + path + "\n";
+			};
+			list(packagesPath(), packagesText);
+			for (auto codec : {"xz", "zst", "gz"}) {
+				auto compressed = compress(codec, packagesText);
+				list(packagesPath() + codecExtension(codec), compressed);
+				files[distPath() + "/" + packagesPath() + codecExtension(codec)] = std::move(compressed);
+			}
+			files[distPath() + "/" + packagesPath()] = packagesText;
+			files[distPath() + "/Release"] = release;
+			files[distPath() + "/InRelease"] = release;
+		}
+
+		static std::string poolPath(const RepoConfig& config, const std::string& name) {
+			return "pool/" + config.component + "/b/" + name + "/" + name + "_1.0_amd64.deb";
+		}
+
+		static std::string stanza(
+			const RepoConfig& config, size_t i, const std::string& depends, size_t size, const std::string& sha256
+		) {
+			std::string name = packageName(i);
+			std::string text = "Package: " + name + "\n";
+			text += "Version: 1.0\nArchitecture: amd64\n";
+			if (!depends.empty()) text += "Depends: " + depends + "\n";
+			text += "Filename: " + poolPath(config, name) + "\n";
+			text += "Size: " + std::to_string(size) + "\n";
+			text += "SHA256: " + sha256 + "\n";
+			text += "Description: synthetic package " + std::to_string(i) + "\n\n";
+			return text;
+		}
+
+		// Only packages with a higher index are depended on, so the graph is a DAG rooted at the low indexes.
+		static std::string dependsFor(const RepoConfig& config, size_t i, std::mt19937_64& rng) {
+			std::string result;
+			size_t remaining = config.packages - i - 1;
+			for (size_t k = 0; k < config.fanOut && remaining > 0; k++) {
+				if (!result.empty()) result += ", ";
+				result += packageName(i + 1 + rng() % remaining);
+				if (k % 4 == 3) result += " (>= 1.0) | " + packageName(i + 1 + rng() % remaining);
+			}
+			return result;
+		}
+
+		std::string buildDeb(const std::string& name, std::mt19937_64& rng) {
+			TarWriter control;
+			control.directory("./");
+			control.file("./control", "Package: " + name + "\nVersion: 1.0\nArchitecture: amd64\n");
+
+			// text-like content, compresses roughly like real binaries and headers do
+			static const std::vector<std::string> words = {
+				"alpha ", "include ", "return ", "struct ", "const ", "0x7f45 ", "\n", "int ", "void ", "std::"};
+			TarWriter data;
+			data.directory("./");
+			data.directory("./usr/");
+			data.directory("./usr/share/");
+			data.directory("./usr/share/" + name + "/");
+			size_t perFile = config.debSize / std::max<size_t>(config.filesPerDeb, 1);
+			for (size_t f = 0; f < config.filesPerDeb; f++) {
+				std::string content;
+				content.reserve(perFile + 16);
+				while (content.size() < perFile) content += words[rng() % words.size()];
+				content.resize(perFile);
+				payloadBytes += content.size();
+				data.file("./usr/share/" + name + "/file" + std::to_string(f), content);
+			}
+			std::string dataTar = data.finish();
+			std::string dataCompressed = compress(config.codec, dataTar);
+
+			std::string deb = "!<arch>\n";
+			arMember(deb, "debian-binary", "2.0\n");
+			arMember(deb, "control.tar.gz", compress("gz", control.finish()));
+			arMember(deb, "data.tar" + codecExtension(config.codec), dataCompressed);
+			dataTars.push_back(std::move(dataCompressed));
+			rawTars.push_back(std::move(dataTar));
+			return deb;
+		}
+	};
+};// namespace bench
@@ -0,0 +1,135 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace deb {
+	// Exposes the next `remaining` bytes of another streambuf, reading it strictly front to back.
+	class LimitedStreambuf : public std::streambuf {
+	public:
+		LimitedStreambuf() {}
+
+		void reset(std::streambuf* src, uint64_t size) {
+			source = src;
+			remaining = size;
+			setg(buffer.data(), buffer.data(), buffer.data());
+		}
+
+		// consume whatever the reader of this member left behind
+		void skipRest() {
+			setg(buffer.data(), buffer.data(), buffer.data());
+			while (remaining > 0) {
+				std::streamsize n = source->sgetn(buffer.data(), std::streamsize(std::min<uint64_t>(remaining, buffer.size())));
+				if (n <= 0) throw std::runtime_error("Unexpected end of archive member");
+				remaining -= n;
+			}
+		}
+
+	protected:
+		int_type underflow() override {
+			if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+			if (remaining == 0 || !source) return traits_type::eof();
+			std::streamsize n = source->sgetn(buffer.data(), std::streamsize(std::min<uint64_t>(remaining, buffer.size())));
+			if (n <= 0) return traits_type::eof();
+			remaining -= n;
+			setg(buffer.data(), buffer.data(), buffer.data() + n);
+			return traits_type::to_int_type(*gptr());
+		}
+
+	private:
+		std::streambuf* source = nullptr;
+		uint64_t remaining = 0;
+		std::vector<char> buffer = std::vector<char>(1 << 16);
+	};
+
+	// Sequential reader for ar archives (the .deb container). Unlike ar::Reader it never seeks,
+	// so it can sit directly on a socket, a pipe or a decompressor.
+	class ArStreamReader {
+	public:
+		struct Member {
+			std::string name;
+			uint64_t size = 0;
+		};
+
+		ArStreamReader(std::istream& in) : in(in), memberStream(nullptr) {
+			char magic[8];
+			if (!in.read(magic, 8) || std::memcmp(magic, "!<arch>\n", 8) != 0)
+				throw std::runtime_error("Not an ar archive");
+			memberStream.rdbuf(&member);
+		}
+
+		// Moves to the next member, skipping the unread part of the current one. Returns false at the end of the archive.
+		bool next(Member& result) {
+			if (started) {
+				member.skipRest();
+				if (padding) in.ignore(1);
+			}
+			started = true;
+
+			char header[60];
+			in.read(header, 60);
+			if (in.gcount() == 0) return false;
+			if (in.gcount() != 60 || header[58] != '`' || header[59] != '\n')
+				throw std::runtime_error("Corrupt ar member header");
+
+			std::string name(header, 16);
+			name.erase(name.find_last_not_of(' ') + 1);
+			if (!name.empty() && name.back() == '/') name.pop_back();// GNU ar terminates names with '/'
+
+			std::string size(header + 48, 10);
+			try {
+				result.size = std::stoull(size);
+			} catch (...) { throw std::runtime_error("Corrupt ar member size for " + name); }
+			result.name = name;
+
+			padding = result.size % 2;
+			member.reset(in.rdbuf(), result.size);
+			memberStream.clear();
+			return true;
+		}
+
+		// body of the member returned by the last next()
+		std::istream& stream() { return memberStream; }
+
+	private:
+		std::istream& in;
+		LimitedStreambuf member;
+		std::istream memberStream;
+		bool started = false;
+		bool padding = false;
+	};
+};// namespace deb
@@ -0,0 +1,252 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+namespace deb {
+	// Global limits on what concurrent downloads may hold at once: bytes still being transferred or extracted, memory
+	// held by downloaded and decompressed buffers, and network bandwidth. 0 leaves a limit off.
+	// Work asks to be admitted with its cost and runs once it fits, the smallest waiting cost first.
+	// Anything is admitted when nothing else holds that resource, so a single oversized job can't wait forever.
+	class Budget {
+	public:
+		struct Cost {
+			uint64_t bytes = 0;
+			uint64_t memory = 0;
+		};
+
+		// Handed to admitted work, what it was admitted with is given back when the last copy is destroyed.
+		using Lease = std::shared_ptr<void>;
+
+		uint64_t maxInFlightBytes = 0;
+		uint64_t maxMemoryBytes = 0;
+		uint64_t maxBytesPerSecond = 0;
+
+		Budget() {}
+		Budget(const Budget&) = delete;
+		Budget& operator=(const Budget&) = delete;
+
+		bool limited() const { return maxInFlightBytes || maxMemoryBytes || maxBytesPerSecond; }
+
+		// Calls launch with a lease once cost fits, right away or from whichever thread gives back enough.
+		// launch should only hand the work to a pool, it runs with no lock held but on a thread someone else owns.
+		void admit(Cost cost, std::function<void(Lease)> launch) {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (!waiting.empty() || !fits(cost)) queuedCount++;
+				waiting.push({cost, sequence++, Clock::now(), std::move(launch)});
+			}
+			pump();
+		}
+
+		// Blocks until size more bytes may go over the network, a token bucket holding at most a second of transfer.
+		void throttle(size_t size) {
+			if (!started) start();
+			if (maxBytesPerSecond == 0) {
+				transferred += size;
+				return;
+			}
+			std::unique_lock<std::mutex> lock(bucketMtx);
+			auto now = Clock::now();
+			double rate = double(maxBytesPerSecond);
+			if (!bucketStarted) {
+				bucketStarted = true;
+				tokens = rate;
+				bucketTime = now;
+			}
+			tokens = std::min(rate, tokens + std::chrono::duration<double>(now - bucketTime).count() * rate);
+			bucketTime = now;
+			tokens -= double(size);
+			transferred += size;
+			// the debt is paid by sleeping, later callers see the bucket already drained and sleep behind us
+			if (tokens < 0) {
+				auto wait = std::chrono::duration<double>(-tokens / rate);
+				throttledNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count();
+				lock.unlock();
+				std::this_thread::sleep_for(wait);
+			}
+		}
+
+		struct Stats {
+			size_t admitted = 0;
+			size_t queued = 0;// could not start the moment they asked
+			double queuedSeconds = 0;// summed over everything that waited
+			uint64_t peakInFlightBytes = 0;
+			uint64_t peakMemoryBytes = 0;
+			uint64_t transferredBytes = 0;
+			double throttledSeconds = 0;
+			double bytesPerSecond = 0;// transferredBytes over the time since the first admission or transfer
+			uint64_t peakRss = 0;// of the whole process
+		};
+
+		Stats stats() {
+			Stats s;
+			std::lock_guard<std::mutex> lock(mtx);
+			s.admitted = admittedCount;
+			s.queued = queuedCount;
+			s.queuedSeconds = queuedNanos / 1e9;
+			s.peakInFlightBytes = peakInFlight;
+			s.peakMemoryBytes = peakMemory;
+			s.transferredBytes = transferred;
+			s.throttledSeconds = throttledNanos / 1e9;
+			if (started) {
+				double seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+				if (seconds > 0) s.bytesPerSecond = transferred / seconds;
+			}
+			s.peakRss = peakRss();
+			return s;
+		}
+
+		std::string report() {
+			auto s = stats();
+			std::stringstream ss;
+			ss << "budget: " << s.admitted << " admitted, " << s.queued << " waited " << s.queuedSeconds << " s, peak "
+			   << s.peakInFlightBytes / 1024 << " KiB in flight, " << s.peakMemoryBytes / 1024 << " KiB buffered, "
+			   << s.bytesPerSecond / 1e6 << " MB/s";
+			if (s.throttledSeconds > 0) ss << " (throttled " << s.throttledSeconds << " s)";
+			ss << ", peak rss " << s.peakRss / (1024 * 1024) << " MiB\n";
+			return ss.str();
+		}
+
+		// High water mark of the resident set in bytes, since the process started or the last resetPeakRss().
+		static uint64_t peakRss() {
+			std::ifstream status("/proc/self/status");
+			std::string line;
+			while (std::getline(status, line))
+				if (line.rfind("VmHWM:", 0) == 0) return std::stoull(line.substr(6)) * 1024;
+			struct rusage usage;
+			if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+			return uint64_t(usage.ru_maxrss) * 1024;// KiB on Linux
+		}
+
+		// Starts a new high water mark so runs in one process can be compared, Linux only and best effort.
+		static void resetPeakRss() { std::ofstream("/proc/self/clear_refs") << "5"; }
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		struct Waiting {
+			Cost cost;
+			uint64_t sequence;
+			Clock::time_point since;
+			std::function<void(Lease)> launch;
+
+			// std::priority_queue pops the largest, so the cheapest compares largest
+			bool operator<(const Waiting& other) const {
+				uint64_t a = cost.bytes + cost.memory, b = other.cost.bytes + other.cost.memory;
+				return a != b ? a > b : sequence > other.sequence;
+			}
+		};
+
+		std::mutex mtx;
+		std::priority_queue<Waiting> waiting;
+		uint64_t sequence = 0;
+		uint64_t inFlight = 0;
+		uint64_t memory = 0;
+		uint64_t peakInFlight = 0;
+		uint64_t peakMemory = 0;
+		size_t admittedCount = 0;
+		size_t queuedCount = 0;
+		uint64_t queuedNanos = 0;
+		std::atomic_bool started{false};
+		Clock::time_point startTime;// guarded by mtx
+
+		std::mutex bucketMtx;
+		bool bucketStarted = false;
+		double tokens = 0;
+		Clock::time_point bucketTime;
+		std::atomic_uint64_t transferred{0};
+		std::atomic_uint64_t throttledNanos{0};
+
+		void start() {
+			std::lock_guard<std::mutex> lock(mtx);
+			if (started) return;
+			startTime = Clock::now();
+			started = true;
+		}
+
+		bool fits(const Cost& cost) {
+			bool bytesFit = maxInFlightBytes == 0 || inFlight == 0 || inFlight + cost.bytes <= maxInFlightBytes;
+			bool memoryFit = maxMemoryBytes == 0 || memory == 0 || memory + cost.memory <= maxMemoryBytes;
+			return bytesFit && memoryFit;
+		}
+
+		// Launches waiting work in cost order for as long as the cheapest of it fits.
+		void pump() {
+			while (true) {
+				std::function<void(Lease)> launch;
+				Cost cost;
+				{
+					std::lock_guard<std::mutex> lock(mtx);
+					if (waiting.empty() || !fits(waiting.top().cost)) return;
+					auto& top = waiting.top();
+					cost = top.cost;
+					launch = std::move(const_cast<Waiting&>(top).launch);
+					auto now = Clock::now();
+					if (!started) {
+						started = true;
+						startTime = now;
+					}
+					admittedCount++;
+					queuedNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(now - top.since).count();
+					waiting.pop();
+					inFlight += cost.bytes;
+					memory += cost.memory;
+					peakInFlight = std::max(peakInFlight, inFlight);
+					peakMemory = std::max(peakMemory, memory);
+				}
+				launch(Lease(nullptr, [this, cost](void*) { release(cost); }));
+			}
+		}
+
+		void release(Cost cost) {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				inFlight -= cost.bytes;
+				memory -= cost.memory;
+			}
+			pump();
+		}
+	};
+};// namespace deb
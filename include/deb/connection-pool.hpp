@@ -0,0 +1,163 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <httplib.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <deb/budget.hpp>
+#include <deb/mirrors.hpp>
+#include <deb/scheduler.hpp>
+#include <deb/tracing.hpp>
+
+namespace deb {
+	// Per host pool of keep-alive httplib clients shared by all workers.
+	// A client is leased to one thread at a time, at most maxConnectionsPerHost of them exist per host.
+	class ConnectionPool {
+	public:
+		class Lease {
+		public:
+			Lease(ConnectionPool* pool, std::string host, std::unique_ptr<httplib::Client> client, size_t generation) :
+				pool(pool), host(host), client(std::move(client)), generation(generation) {}
+			Lease(const Lease&) = delete;
+			Lease(Lease&& other) :
+				pool(other.pool), host(std::move(other.host)), client(std::move(other.client)),
+				generation(other.generation) {
+				other.pool = nullptr;
+			}
+			~Lease() {
+				if (pool) pool->release(host, std::move(client), generation);
+			}
+
+			httplib::Client* operator->() { return client.get(); }
+			httplib::Client& operator*() { return *client; }
+
+			// the connection is in an unknown state (timeout, reset), close it instead of handing it to the next request
+			void discard() { client = nullptr; }
+
+		private:
+			ConnectionPool* pool = nullptr;
+			std::string host;
+			std::unique_ptr<httplib::Client> client;
+			size_t generation = 0;// of the pool when leased, a clear() since makes it close on release
+		};
+
+		size_t maxConnectionsPerHost = 8;
+		Tracer* tracer = nullptr;
+		// equivalent mirrors and their measured speed, downloads spread and hedge across them when set
+		MirrorSet* mirrors = nullptr;
+		// every byte received is paid for here when set, see Budget::maxBytesPerSecond
+		Budget* budget = nullptr;
+		// io lane hedged downloads send their duplicate request on, without it they only fail over
+		Scheduler* scheduler = nullptr;
+
+		ConnectionPool() {}
+		ConnectionPool(const ConnectionPool&) = delete;
+		ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+		// host is scheme + host (+ port), like "http://archive.ubuntu.com"
+		Lease acquire(const std::string& host) {
+			requestCount++;
+			std::unique_lock<std::mutex> lock(mtx);
+			auto& entry = hosts[host];
+			auto available = [&] { return !entry.idle.empty() || entry.open < maxConnectionsPerHost; };
+			if (!available()) {
+				// every connection to host is leased out
+				auto span = tracer ? tracer->span("connection wait", host) : Tracer::Span();
+				cv.wait(lock, available);
+			}
+			if (!entry.idle.empty()) {
+				auto client = std::move(entry.idle.back());
+				entry.idle.pop_back();
+				return Lease(this, host, std::move(client), generation);
+			}
+			entry.open++;
+			size_t leased = generation;
+			lock.unlock();
+
+			auto client = std::make_unique<httplib::Client>(host.c_str());
+			client->set_keep_alive(true);
+			client->set_follow_location(true);
+			// called for every socket httplib opens, including silent reconnects after the server closed an idle one
+			client->set_socket_options([this](httplib::socket_t) { connectionCount++; });
+			return Lease(this, host, std::move(client), leased);
+		}
+
+		// drop every idle connection, leased ones are closed when they come back
+		void clear() {
+			std::lock_guard<std::mutex> lock(mtx);
+			generation++;
+			for (auto& [host, entry] : hosts) {
+				entry.open -= entry.idle.size();
+				entry.idle.clear();
+			}
+			cv.notify_all();
+		}
+
+		size_t requests() const { return requestCount; }
+		size_t connections() const { return connectionCount; }
+		double reuseRatio() const {
+			size_t r = requestCount;
+			if (r == 0) return 0;
+			size_t c = connectionCount;
+			return c >= r ? 0.0 : double(r - c) / double(r);
+		}
+
+	private:
+		struct HostEntry {
+			std::vector<std::unique_ptr<httplib::Client>> idle;
+			size_t open = 0;
+		};
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::map<std::string, HostEntry> hosts;
+		size_t generation = 0;// bumped by clear()
+		std::atomic_size_t requestCount{0};
+		std::atomic_size_t connectionCount{0};
+
+		void release(const std::string& host, std::unique_ptr<httplib::Client> client, size_t leased) {
+			std::lock_guard<std::mutex> lock(mtx);
+			auto& entry = hosts[host];
+			// a discarded one, or one leased before clear()
+			if (client && leased == generation) entry.idle.push_back(std::move(client));
+			else
+				entry.open--;
+			cv.notify_one();
+		}
+	};
+};// namespace deb
@@ -0,0 +1,117 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+namespace deb {
+	// Content addressed store of downloaded .deb files, keyed by the SHA256 from their Packages stanza.
+	// Files only enter the store after their hash was verified, so a hit can be used without touching the network.
+	class DebCache {
+	public:
+		// Collects one download into a temporary file, commit() moves it into the store if the hash matches.
+		class Writer {
+		public:
+			Writer(std::filesystem::path tmpFile, std::filesystem::path finalFile, std::string sha256) :
+				tmpFile(tmpFile), finalFile(finalFile), sha256(sha256) {
+				std::filesystem::create_directories(tmpFile.parent_path());
+				file.open(tmpFile, std::ios::binary | std::ios::trunc);
+				if (!file) throw std::runtime_error("Failed to create " + tmpFile.string());
+			}
+			Writer(const Writer&) = delete;
+			~Writer() {
+				if (!committed) {
+					file.close();
+					std::error_code ec;
+					std::filesystem::remove(tmpFile, ec);
+				}
+			}
+
+			void write(const char* data, size_t size) {
+				file.write(data, size);
+				if (!file) throw std::runtime_error("Failed to write " + tmpFile.string());
+			}
+
+			void commit(const std::string& actualSha256) {
+				file.close();
+				if (actualSha256 != sha256) throw std::runtime_error("sha256 mismatch for " + finalFile.string());
+				std::filesystem::create_directories(finalFile.parent_path());
+				std::filesystem::rename(tmpFile, finalFile);
+				committed = true;
+			}
+
+		private:
+			std::filesystem::path tmpFile;
+			std::filesystem::path finalFile;
+			std::string sha256;
+			std::ofstream file;
+			bool committed = false;
+		};
+
+		DebCache(std::filesystem::path directory) : directory(directory) {}
+
+		std::filesystem::path pathFor(const std::string& sha256) {
+			return directory / "sha256" / sha256.substr(0, 2) / (sha256 + ".deb");
+		}
+
+		bool contains(const std::string& sha256) { return std::filesystem::is_regular_file(pathFor(sha256)); }
+
+		// moves an already verified file into the store, copying if it lives on another filesystem
+		std::filesystem::path adopt(const std::filesystem::path& file, const std::string& sha256) {
+			auto target = pathFor(sha256);
+			std::filesystem::create_directories(target.parent_path());
+			std::error_code ec;
+			std::filesystem::rename(file, target, ec);
+			if (ec) {
+				auto tmp = target.string() + "." + std::to_string(getpid()) + ".part";
+				std::filesystem::copy_file(file, tmp, std::filesystem::copy_options::overwrite_existing);
+				std::filesystem::rename(tmp, target);
+			}
+			return target;
+		}
+
+		std::unique_ptr<Writer> write(const std::string& sha256) {
+			static std::atomic_size_t counter{0};
+			auto tmp = directory / "tmp" /
+					   (sha256 + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".part");
+			return std::make_unique<Writer>(tmp, pathFor(sha256), sha256);
+		}
+
+	private:
+		std::filesystem::path directory;
+	};
+};// namespace deb
@@ -31,16 +31,21 @@
 #pragma once
 
 #define CPPHTTPLIB_OPENSSL_SUPPORT
-#include <ar/ar.hpp>
+#include <algorithm>
+#include <atomic>
 #include <boost/regex.hpp>
 #include <bxzstr.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <estd/filesystem.hpp>
 #include <estd/ostream_proxy.hpp>
 #include <estd/ptr.hpp>
 #include <estd/semaphore.h>
-#include <estd/thread_pool.hpp>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <httplib.h>
 #include <iostream>
 #include <map>
@@ -48,7 +53,31 @@
 #include <sstream>
 #include <tar/tar.hpp>
 #include <thread>
-
+#include <unistd.h>
+
+#include <deb/ar-stream.hpp>
+#include <deb/budget.hpp>
+#include <deb/connection-pool.hpp>
+#include <deb/deb-cache.hpp>
+#include <deb/decompress.hpp>
+#include <deb/dependencies.hpp>
+#include <deb/dependency-graph.hpp>
+#include <deb/file-writer.hpp>
+#include <deb/index-cache.hpp>
+#include <deb/lockfile.hpp>
+#include <deb/manifest.hpp>
+#include <deb/mapped-file.hpp>
+#include <deb/mirrors.hpp>
+#include <deb/package-index.hpp>
+#include <deb/packages-parser.hpp>
+#include <deb/pdiff.hpp>
+#include <deb/progress.hpp>
+#include <deb/release.hpp>
+#include <deb/scheduler.hpp>
+#include <deb/sha256.hpp>
+#include <deb/streams.hpp>
+#include <deb/tar-stream.hpp>
+#include <deb/tracing.hpp>
 #include <estd/AnsiEscape.hpp>
 #include <set>
 
@@ -134,7 +163,7 @@ namespace deb {
 			return make_tuple(scheme, host, path);
 		}
 
-		std::string downloadString(string url) {
+		httplib::Response downloadResponse(ConnectionPool& pool, string url, httplib::Headers headers = {}) {
 			int numRetry = 3;
 			for (int i = 1; i <= numRetry; i++) {
 				try {
@@ -144,14 +173,18 @@ namespace deb {
 
 					tie(scheme, host, path) = splitUrl(url);
 
-					httplib::Client cli((scheme + host).c_str());
-					cli.set_follow_location(true);
-					cli.set_read_timeout(5);
-					cli.set_connection_timeout(7);
-					cli.set_write_timeout(3);
-					auto res = cli.Get(path.c_str());
-					if (res.error() != httplib::Error::Success) throw runtime_error("Request error " + url);
-					return res->body;
+					auto cli = pool.acquire(scheme + host);
+					cli->set_read_timeout(5);
+					cli->set_connection_timeout(7);
+					cli->set_write_timeout(3);
+					auto res = cli->Get(path.c_str(), headers);
+					if (res.error() != httplib::Error::Success) {
+						cli.discard();
+						throw runtime_error("Request error " + url);
+					}
+					// the body arrived in one piece, its bandwidth is paid for afterwards and slows the next request
+					if (pool.budget) pool.budget->throttle(res->body.size());
+					return *res;
 				} catch (exception& e) {
 					if (i == numRetry) throw e;
 				}
@@ -159,56 +192,338 @@ namespace deb {
 			throw runtime_error("Failed to fetch url: " + url);
 		}
 
-		std::filesystem::path downloadFile(string url, std::filesystem::path location) {
-			int numRetry = 3;
-			for (int i = 1; i <= numRetry; i++) {
-				try {
-					std::string scheme = "";
-					std::string host = "";
-					std::string path = "";
-
-					tie(scheme, host, path) = splitUrl(url);
-
-					std::filesystem::path extractFilename = path;
-					std::filesystem::path filename = extractFilename.filename();
+		// Where a file:// url or a plain directory source points on disk, empty for anything fetched over the network.
+		std::filesystem::path localPath(const string& url) {
+			if (url.rfind("file:", 0) == 0) return url.substr(url.rfind("file://", 0) == 0 ? 7 : 5);
+			if (url.rfind("/", 0) == 0 || url.rfind("./", 0) == 0 || url.rfind("../", 0) == 0) return url;
+			return "";
+		}
 
-					fs::create_directories(location);
+		std::string downloadString(ConnectionPool& pool, string url) {
+			auto local = localPath(url);
+			if (!local.empty()) {
+				std::ifstream in(local, ios::binary);
+				if (!in) throw runtime_error("Failed to open " + local.string());
+				std::stringstream ss;
+				ss << in.rdbuf();
+				return ss.str();
+			}
+			auto res = downloadResponse(pool, url);
+			if (res.status != 200) throw runtime_error("Bad status " + to_string(res.status) + " for " + url);
+			return res.body;
+		}
 
-					ofstream file(location / filename);
+		// Single attempt at streaming the bytes [begin, end) of url into sink, end = 0 means up to the end of the file.
+		// Throws on transport errors and bad statuses. A server that ignores Range and answers 200 is handled by
+		// skipping ahead, so callers always see the bytes they asked for.
+		// onClient sees the client while the request is running (and nullptr after), so another thread can stop() it.
+		void downloadRange(
+			ConnectionPool& pool,
+			string url,
+			uint64_t begin,
+			uint64_t end,
+			std::function<bool(const char*, size_t)> sink,
+			std::function<void(httplib::Client*)> onClient = nullptr
+		) {
+			std::string scheme = "";
+			std::string host = "";
+			std::string path = "";
 
-					httplib::Client cli((scheme + host).c_str());
-					cli.set_read_timeout(20);
-					cli.set_connection_timeout(20);
-					cli.set_write_timeout(20);
-					cli.set_follow_location(true);
+			tie(scheme, host, path) = splitUrl(url);
+
+			auto cli = pool.acquire(scheme + host);
+			cli->set_read_timeout(20);
+			cli->set_connection_timeout(20);
+			cli->set_write_timeout(20);
+
+			httplib::Headers headers;
+			if (begin > 0 || end > 0)
+				headers.emplace("Range", "bytes=" + to_string(begin) + "-" + (end > 0 ? to_string(end - 1) : string()));
+
+			int status = 0;
+			uint64_t skip = 0;
+			uint64_t remaining = end > 0 ? end - begin : UINT64_MAX;
+			// connect + request + time to first byte
+			auto request = pool.tracer ? pool.tracer->span("request", url) : Tracer::Span();
+			auto started = std::chrono::steady_clock::now(), answered = started;
+			uint64_t received = 0;
+			if (onClient) onClient(&*cli);
+			auto res = cli->Get(
+				path.c_str(),
+				headers,
+				[&](const httplib::Response& response) {
+					request.end();
+					answered = std::chrono::steady_clock::now();
+					status = response.status;
+					if (status == 200) skip = begin;
+					if (pool.mirrors && (status == 200 || status == 206))
+						pool.mirrors->recordLatency(url, std::chrono::duration<double>(answered - started).count());
+					return status == 200 || status == 206;
+				},
+				[&](const char* data, size_t data_length) {
+					size_t skipped = std::min<uint64_t>(skip, data_length);
+					skip -= skipped;
+					size_t length = std::min<uint64_t>(data_length - skipped, remaining);
+					remaining -= length;
+					received += length;
+					if (pool.tracer) pool.tracer->count(Tracer::BytesDownloaded, length);
+					if (pool.budget) pool.budget->throttle(length);
+					if (length > 0 && !sink(data + skipped, length)) return false;
+					// a full 200 body only has to be read up to end
+					return status == 206 || remaining > 0;
+				}
+			);
+			if (onClient) onClient(nullptr);
+			if (pool.mirrors) {
+				auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - answered).count();
+				pool.mirrors->recordTransfer(url, received, seconds);
+			}
+			if (res.error() != httplib::Error::Success) {
+				cli.discard();
+				if (status != 0 && status != 200 && status != 206)
+					throw runtime_error("Bad status " + to_string(status) + " for " + url);
+				if (!(status == 200 && end > 0 && remaining == 0)) throw runtime_error("Request error " + url);
+			}
+			if (end > 0 && remaining != 0) throw runtime_error("Short read of " + url);
+		}
 
-					auto res = cli.Get(
-						path.c_str(),
-						httplib::Headers(),
-						[&](const httplib::Response& response) {
-							return true;// return 'false' if you want to cancel the request.
-						},
-						[&](const char* data, size_t data_length) {
-							file.write(data, data_length);
-							return true;// return 'false' if you want to cancel the request.
+		// Streams [begin, end) from the first of urls. When it hasn't delivered a byte after hedgeDelay seconds the same
+		// range is requested from the next url too, on pool.scheduler's io lane, the first one to deliver wins and the
+		// other is stopped. The first request runs on the calling thread, so a saturated io lane only delays the hedge.
+		// A url failing before delivering anything hands over to the next one right away.
+		// Only the winner ever calls sink, errors after it started delivering are thrown.
+		void downloadHedged(
+			ConnectionPool& pool,
+			const vector<string>& urls,
+			uint64_t begin,
+			uint64_t end,
+			std::function<bool(const char*, size_t)> sink,
+			double hedgeDelay
+		) {
+			// the hedge task may only get a thread after this returned, it then sees closed and touches nothing else
+			struct State {
+				std::mutex mtx;
+				std::condition_variable cv;
+				int winner = -1;
+				size_t next = 0;
+				size_t hedgeIndex = SIZE_MAX;// the attempt started by the hedge rather than by a failure
+				bool hedgeRunning = false;
+				bool closed = false;
+				vector<httplib::Client*> clients;
+				vector<std::exception_ptr> errors;
+			};
+			auto state = std::make_shared<State>();
+			auto& s = *state;
+			s.clients.resize(urls.size(), nullptr);
+			s.errors.resize(urls.size());
+
+			auto claim = [&](int i) {
+				std::lock_guard<std::mutex> lock(s.mtx);
+				if (s.winner == -1) {
+					s.winner = i;
+					for (size_t j = 0; j < s.clients.size(); j++)
+						if (int(j) != i && s.clients[j]) s.clients[j]->stop();
+					if (size_t(i) == s.hedgeIndex && pool.mirrors) pool.mirrors->recordHedgeWin();
+					s.cv.notify_all();
+				}
+				return s.winner == i;
+			};
+			auto attempt = [&](size_t i) {
+				try {
+					downloadRange(
+						pool,
+						urls[i],
+						begin,
+						end,
+						[&](const char* data, size_t size) { return claim(i) && sink(data, size); },
+						[&](httplib::Client* client) {
+							std::lock_guard<std::mutex> lock(s.mtx);
+							s.clients[i] = client;
 						}
 					);
+					claim(i);// an empty body never reaches the sink
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(s.mtx);
+					// a request stopped because another one won isn't the host's fault
+					if (pool.mirrors && (s.winner == -1 || s.winner == int(i))) pool.mirrors->recordFailure(urls[i]);
+					s.errors[i] = std::current_exception();
+				}
+			};
 
-					file.close();
-					if (res.error() != httplib::Error::Success) throw runtime_error("Request error " + url);
-					return location / filename;
+			if (pool.scheduler && hedgeDelay >= 0 && urls.size() > 1) {
+				auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(hedgeDelay);
+				pool.scheduler->io(Scheduler::Download, [&, state, deadline] {
+					std::unique_lock<std::mutex> lock(state->mtx);
+					if (state->cv.wait_until(lock, deadline, [&] { return state->closed || state->winner != -1; }))
+						return;
+					if (state->next == urls.size()) return;
+					if (pool.mirrors) pool.mirrors->recordHedge();
+					state->hedgeIndex = state->next++;
+					state->hedgeRunning = true;
+					lock.unlock();
+					attempt(state->hedgeIndex);
+					lock.lock();
+					state->hedgeRunning = false;
+					state->cv.notify_all();
+				});
+			}
+
+			std::unique_lock<std::mutex> lock(s.mtx);
+			while (s.winner == -1 && s.next < urls.size()) {
+				size_t i = s.next++;
+				lock.unlock();
+				attempt(i);
+				lock.lock();
+			}
+			s.closed = true;
+			s.cv.notify_all();
+			// a losing hedge was stopped when the winner claimed, waiting on it doesn't wait on its timeouts
+			s.cv.wait(lock, [&] { return !s.hedgeRunning; });
+
+			if (s.winner >= 0) {
+				if (s.errors[s.winner]) std::rethrow_exception(s.errors[s.winner]);
+				return;
+			}
+			for (size_t i = urls.size(); i-- > 0;)
+				if (s.errors[i]) std::rethrow_exception(s.errors[i]);
+		}
+
+		// Streams [begin, end) of url into sink. When the connection drops the next attempt asks for the rest with
+		// a Range request instead of starting over, sink sees every byte exactly once.
+		// With pool.mirrors set every attempt goes to the fastest equivalent mirror, hedged against the next fastest.
+		void downloadResumable(
+			ConnectionPool& pool,
+			string url,
+			uint64_t begin,
+			uint64_t end,
+			std::function<bool(const char*, size_t)> sink,
+			int numRetry = 3
+		) {
+			uint64_t delivered = begin;
+			bool cancelled = false;
+			auto counted = [&](const char* data, size_t size) {
+				if (!sink(data, size)) {
+					cancelled = true;
+					return false;
+				}
+				delivered += size;
+				return true;
+			};
+			for (int i = 1;; i++) {
+				try {
+					auto urls = pool.mirrors ? pool.mirrors->candidates(url, end > 0 ? end - delivered : 0)
+											 : vector<string>{url};
+					if (urls.size() == 1) {
+						try {
+							downloadRange(pool, url, delivered, end, counted);
+						} catch (...) {
+							if (pool.mirrors && !cancelled) pool.mirrors->recordFailure(url);
+							throw;
+						}
+					} else {
+						downloadHedged(pool, urls, delivered, end, counted, pool.mirrors->hedgeDelay(urls[0]));
+					}
+					return;
 				} catch (exception& e) {
-					if (i == numRetry) throw e;
+					if (i == numRetry || cancelled) throw;
 				}
 			}
-			throw runtime_error("Failed to fetch url: " + url);
+		}
+
+		void writeAt(int fd, const char* data, size_t size, uint64_t offset) {
+			while (size > 0) {
+				ssize_t n = ::pwrite(fd, data, size, offset);
+				if (n < 0) {
+					if (errno == EINTR) continue;
+					throw runtime_error("write failed: " + string(strerror(errno)));
+				}
+				data += n;
+				size -= n;
+				offset += n;
+			}
+		}
+
+		// Downloads url into location, retries resume from the last byte written. When size is known and at least
+		// chunkThreshold, the file is preallocated and fetched as `chunks` concurrent range requests.
+		// hash, when given, ends up over the whole file: a single stream feeds it the bytes in order as they are
+		// written, only chunks arriving out of order make it read the finished file back.
+		std::filesystem::path downloadFile(
+			ConnectionPool& pool,
+			string url,
+			std::filesystem::path location,
+			uint64_t size = 0,
+			size_t chunks = 1,
+			uint64_t chunkThreshold = UINT64_MAX,
+			Sha256* hash = nullptr
+		) {
+			std::string scheme = "";
+			std::string host = "";
+			std::string path = "";
+
+			tie(scheme, host, path) = splitUrl(url);
+
+			std::filesystem::path extractFilename = path;
+			std::filesystem::path filename = extractFilename.filename();
+
+			fs::create_directories(location);
+
+			int fd = ::open((location / filename).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0) throw runtime_error("could not create " + (location / filename).string());
+			std::shared_ptr<void> _(nullptr, bind([&] { ::close(fd); }));
+
+			if (size == 0 || size < chunkThreshold || chunks == 0) chunks = 1;
+			// reserving the blocks up front keeps concurrent chunks from fragmenting the file
+			if (size > 0 && ::posix_fallocate(fd, 0, size) != 0 && ::ftruncate(fd, size) != 0)
+				throw runtime_error("could not allocate " + (location / filename).string());
+
+			uint64_t chunkSize = chunks > 1 ? (size + chunks - 1) / chunks : 0;
+			std::vector<uint64_t> written(chunks, 0);
+			std::vector<std::exception_ptr> errors(chunks);
+			auto fetchChunk = [&](size_t c) {
+				try {
+					uint64_t begin = c * chunkSize;
+					uint64_t end = chunks > 1 ? std::min(size, begin + chunkSize) : 0;
+					downloadResumable(pool, url, begin, end, [&](const char* data, size_t length) {
+						writeAt(fd, data, length, begin + written[c]);
+						written[c] += length;
+						// resumes continue where the last byte was delivered, a single stream arrives in order
+						if (hash && chunks == 1) hash->update(data, length);
+						return true;
+					});
+				} catch (...) { errors[c] = std::current_exception(); }
+			};
+
+			std::vector<std::thread> workers;
+			for (size_t c = 1; c < chunks; c++) workers.emplace_back(fetchChunk, c);
+			fetchChunk(0);
+			for (auto& w : workers) w.join();
+			for (auto& error : errors)
+				if (error) std::rethrow_exception(error);
+
+			// a single stream decides the length itself, drop whatever the preallocation guessed
+			if (chunks == 1 && ::ftruncate(fd, written[0]) != 0)
+				throw runtime_error("could not resize " + (location / filename).string());
+			if (hash && chunks > 1) {
+				ifstream in(location / filename, ios::binary);
+				std::vector<char> chunk(1 << 16);
+				while (in.read(chunk.data(), chunk.size()) || in.gcount() > 0) hash->update(chunk.data(), in.gcount());
+			}
+			return location / filename;
 		}
 
 		std::vector<std::string> split(const string& input, const string& regex) {
 			// passing -1 as the submatch index parameter performs splitting
 			static map<string, boost::regex> rgx;
-			if (!rgx.count(regex)) rgx[regex] = boost::regex(regex, boost::regex::optimize);
-			boost::sregex_token_iterator first{input.begin(), input.end(), rgx[regex], -1}, last;
+			// concurrent resolutions share the cache, a compiled regex itself is safe to match from several threads
+			static std::mutex rgxMtx;
+			const boost::regex* compiled;
+			{
+				std::lock_guard<std::mutex> lock(rgxMtx);
+				auto it = rgx.find(regex);
+				if (it == rgx.end()) it = rgx.emplace(regex, boost::regex(regex, boost::regex::optimize)).first;
+				compiled = &it->second;
+			}
+			boost::sregex_token_iterator first{input.begin(), input.end(), *compiled, -1}, last;
 			return {first, last};
 		}
 
@@ -221,20 +536,94 @@ namespace deb {
 
 	using namespace std;
 
+	// A package picked by the resolver, carries everything needed to fetch it without another index lookup.
+	struct PlannedPackage {
+		// the package's own name in the index, never the Provides or Source alias it was reached through. Contents,
+		// lockfiles and manifests all go by it
+		std::string name;
+		std::string url;
+		std::string sha256;
+		uint64_t size = 0;
+	};
+
+	// Size of a resolved install next to what following every dependency edge would have pulled in.
+	struct ResolutionReport {
+		size_t packages = 0;
+		uint64_t bytes = 0;
+		size_t unfilteredPackages = 0;
+		uint64_t unfilteredBytes = 0;
+	};
+
+	// One Packages index named by a sources line: a component of a distribution for the configured architecture.
+	struct IndexSource {
+		std::string baseUrl;
+		std::string distUrl;// baseUrl/dists/<distribution>
+		std::string path;// relative to distUrl, like "main/binary-amd64/Packages"
+	};
+
+	// One target of a batched install: whitespace separated package names and where their files go.
+	struct InstallJob {
+		std::string packages;
+		std::set<std::pair<std::string, std::string>> locations;
+	};
+
+	// What fetching the sources produced, kept apart from the Installer until it is used, so the current index can
+	// go on serving lookups while a new one is built.
+	struct PackageList {
+		PackageIndex index;
+		std::vector<IndexSource> sources;
+		std::map<std::string, ReleaseFile> releases;
+	};
+
 	class Installer {
 	public:
 		estd::ostream_proxy cout;
 		estd::ostream_proxy liveViewInstalling;
-		std::set<std::string> currentlyInstallingList;
+		ProgressTracker progress;
 		std::vector<std::string> sourcesList;
-		std::map<std::string, std::string> packageToUrl;
+		PackageIndex packageIndex;
 		std::set<string> installed;
 		std::set<string> preInstalled;
-		std::mutex installLock;
-		estd::thread_pool trm{16};
+		// spans and counters of the install, recorded only while tracer.enabled (or traceFile) is set
+		Tracer tracer;
+		// keep-alive connections shared by every worker, connectionPool.maxConnectionsPerHost caps them per mirror
+		ConnectionPool connectionPool;
+		// sources serving the same packages, configured with mirrors.addGroup() or found by detectMirrors.
+		// Every download goes to the fastest of them and is hedged once the first one is unusually slow
+		MirrorSet mirrors;
+		// caps on bytes being downloaded or waiting for extraction, on index and stream buffers held in memory and on
+		// bandwidth, all off by default. Downloads and index fetches wait for room, the smallest first
+		Budget budget;
+		// link sources that list a package at the same path with the same SHA256 as mirrors of each other
+		bool detectMirrors = true;
+		// write-out stage shared by every extract task, see writerThreads
+		std::unique_ptr<FileWriter> writer;
+		// dependencies of packageIndex by package id, compiled on demand by the resolver
+		std::unique_ptr<DependencyGraph> graph;
+		// what the package index was last built from
+		vector<IndexSource> indexSources;
+		std::map<string, ReleaseFile> releaseFiles;
+		// one per destination of the running installs, guarded by manifestMtx while packages extract.
+		// Installs into the same destination at the same time share it, manifestUsers counts them
+		std::map<std::string, InstallManifest> manifests;
+		std::map<std::string, size_t> manifestUsers;
+		std::mutex manifestMtx;
+		std::unique_ptr<Scheduler> scheduler;
+		std::once_flag schedulerCreated;
+		// one per indexCacheDirectory, so its lock covers every concurrent fetch into that directory
+		std::shared_ptr<IndexCache> cache;
+		std::mutex cacheMtx;
+
+		// Held by the caller for the whole fetch, a new indexCacheDirectory only affects fetches started after it.
+		std::shared_ptr<IndexCache> indexCache() {
+			std::lock_guard<std::mutex> lock(cacheMtx);
+			if (!cache || cache->path() != indexCacheDirectory)
+				cache = std::make_shared<IndexCache>(indexCacheDirectory);
+			return cache;
+		}
 
-		vector<tuple<string, string>> getListUrls() {
-			vector<tuple<string, string>> result;
+		vector<IndexSource> getIndexSources() {
+			vector<IndexSource> result;
 			for (auto source : sourcesList) {
 				stringstream ss(source);
 				string token;
@@ -248,214 +637,1025 @@ namespace deb {
 				string component;
 
 				while (ss >> component) {
-					tuple<string, string> t = {
-						baseUrl,
-						baseUrl + "/dists/" + distribution + "/" + component + "/" + architecture + "/" +
-							"Packages.gz"};
-					result.push_back(t);
+					result.push_back(
+						{baseUrl, baseUrl + "/dists/" + distribution, component + "/" + architecture + "/Packages"}
+					);
 				}
 			}
-			for (const auto& elem : result) cout << get<1>(elem) << "\n";
+			for (const auto& elem : result) cout << elem.distUrl + "/" + elem.path << "\n";
 			return result;
 		}
-		void getPackageList() {
-			auto urls = getListUrls();
-			std::vector<std::map<std::string, std::string>> packageToUrlMaps;
-			packageToUrlMaps.resize(urls.size());
-			int k = 0;
-			std::atomic_int32_t successfulSources = 0;
-			for (const auto& entry : urls) {
-				auto* mapToPlace = &packageToUrlMaps[k];
-				k++;
-				trm.schedule([=, &successfulSources, this]() {
-					string listUrl;
-					string baseUrl;
-					tie(baseUrl, listUrl) = entry;
 
-					stringstream compressed;
+		// InRelease (or Release) of a distribution, empty when the repository has neither.
+		ReleaseFile fetchRelease(const string& distUrl) {
+			for (auto name : {"/InRelease", "/Release"}) {
+				try {
+					auto fetched = fetchIndex(distUrl + name);
+					if (fetched.cachedFile.empty()) return ReleaseFile::parse(fetched.body);
+					IndexCache::Entry entry;
+					entry.file = fetched.cachedFile;
+					return ReleaseFile::parse(indexCache()->read(entry));
+				} catch (...) {}
+			}
+			return ReleaseFile();
+		}
 
-					try {
-						compressed = stringstream{downloadString(listUrl)};
-						successfulSources++;
-					} catch (...) {
-						std::string errm = "Failed to fetch URL " + listUrl;
-						if (throwOnFailedSourceURL) throw std::runtime_error(errm);
-						else
-							cout << errm;
-					}
+		// Fetches a repository index, going through indexCacheDirectory when it is set.
+		// A cached copy is revalidated with If-None-Match / If-Modified-Since, so an unchanged index costs a single 304.
+		FetchedIndex fetchIndex(const string& listUrl) {
+			FetchedIndex result;
+			result.url = listUrl;
+			// local repositories are mapped by the parser where they are, never copied or cached
+			auto local = localPath(listUrl);
+			if (!local.empty()) {
+				std::error_code ec;
+				auto size = fs::file_size(local, ec);
+				if (ec) throw runtime_error("Failed to open " + local.string());
+				auto modified = fs::last_write_time(local, ec).time_since_epoch().count();
+				result.cachedFile = local;
+				result.validator = "local " + to_string(size) + " " + to_string(modified);
+				result.ok = true;
+				return result;
+			}
+			if (indexCacheDirectory.empty()) {
+				result.body = downloadString(connectionPool, listUrl);
+				result.ok = true;
+				return result;
+			}
 
-					bxz::istream decompressed(compressed);
-					stringstream ss;
-					ss << decompressed.rdbuf();
-
-					vector<string> entries = split(ss.str(), "\n\n");
-					cout << entries.size() << "\n";
-
-					for (string entry : entries) {
-						string packageName = "";
-						string packagePath = "";
-						{
-							static boost::regex rgx("Package:\\s?([^\\r\\n]*)", boost::regex::optimize);
-							boost::smatch matches;
-							if (boost::regex_search(entry, matches, rgx) && matches.size() == 2) {
-								packageName = matches[1];
-							} else {
-								cout << "Match not found\n";
-								continue;
-							}
-						}
-						{
-							static boost::regex rgx("Filename:\\s?([^\\r\\n]*)", boost::regex::optimize);
-							boost::smatch matches;
-							if (boost::regex_search(entry, matches, rgx) && matches.size() == 2) {
-								packagePath = matches[1];
-							} else {
-								cout << "Match not found\n";
-								continue;
-							}
-						}
-						packagePath = baseUrl + "/" + packagePath;
-						auto provides = getFields(entry, "Provides");
-						auto source = getFields(entry, "Source");
-						provides.insert(provides.end(), source.begin(), source.end());
-						provides.push_back(packageName);
-						for (auto i : provides) {
-							if (!mapToPlace->count(i)) { (*mapToPlace)[i] = packagePath; }
+			auto cache = indexCache();
+			IndexCache::Entry entry;
+			httplib::Headers headers;
+			bool cached = cache->lookup(listUrl, entry);
+			if (cached) {
+				if (!entry.etag.empty()) headers.emplace("If-None-Match", entry.etag);
+				if (!entry.lastModified.empty()) headers.emplace("If-Modified-Since", entry.lastModified);
+			}
+
+			auto res = downloadResponse(connectionPool, listUrl, headers);
+			if (cached && res.status == 304) {
+				result.cachedFile = entry.file;
+				result.validator = IndexCache::validator(entry.etag, entry.lastModified);
+				result.ok = true;
+				return result;
+			}
+			if (res.status != 200) throw runtime_error("Bad status " + to_string(res.status) + " for " + listUrl);
+
+			auto etag = res.get_header_value("ETag");
+			auto lastModified = res.get_header_value("Last-Modified");
+			// read back from the cache when parsed, the body doesn't have to stay in memory until then
+			result.cachedFile = cache->store(listUrl, res.body, etag, lastModified);
+			result.validator = IndexCache::validator(etag, lastModified);
+			result.ok = true;
+			return result;
+		}
+
+		// Fetches the Packages index of source. With a Release file the smallest compressed variant is downloaded
+		// and checked against its SHA256 (see verifyChecksums), and with indexCacheDirectory set an outdated cached copy is brought up to date
+		// with pdiffs instead of being downloaded again.
+		FetchedIndex fetchPackages(const IndexSource& source, const ReleaseFile& release) {
+			string variant = release.pickVariant(source.path);
+			// flat repositories and mirrors without a usable Release file
+			if (variant.empty()) return fetchIndex(source.distUrl + "/" + source.path + ".gz");
+
+			const ChecksumEntry* plain = release.find(source.path);
+			const ChecksumEntry* compressed = release.find(variant);
+			string plainUrl = source.distUrl + "/" + source.path;
+			FetchedIndex result;
+			result.ok = true;
+
+			if (!localPath(source.distUrl).empty()) {
+				result = fetchIndex(source.distUrl + "/" + variant);
+				if (verifyChecksums) {
+					MappedFile file(result.cachedFile);
+					Sha256 hash;
+					hash.update(file.data(), file.size());
+					if (hash.hex() != compressed->sha256) throw runtime_error("sha256 mismatch for " + variant);
+				}
+				result.validator = compressed->sha256;
+				return result;
+			}
+
+			if (!indexCacheDirectory.empty() && plain) {
+				auto cache = indexCache();
+				IndexCache::Entry entry;
+				if (cache->lookup(plainUrl, entry) && !entry.sha256.empty()) {
+					result.url = plainUrl;
+					result.validator = plain->sha256;
+					if (entry.sha256 == plain->sha256) {
+						result.cachedFile = entry.file;
+						return result;
+					}
+					if (release.find(source.path + ".diff/Index")) {
+						try {
+							string patched = patchIndex(source, release, cache->read(entry), entry.sha256);
+							result.cachedFile = cache->store(plainUrl, patched, "", "", plain->sha256);
+							return result;
+						} catch (exception& e) {
+							cout << "pdiff update of " + plainUrl + " failed, fetching it in full (" + e.what() + ")\n";
 						}
 					}
+				}
+			}
+
+			string body = downloadString(connectionPool, source.distUrl + "/" + variant);
+			if (verifyChecksums && Sha256::of(body) != compressed->sha256)
+				throw runtime_error("sha256 mismatch for " + variant);
+			if (indexCacheDirectory.empty() || !plain) {
+				result.url = source.distUrl + "/" + variant;
+				result.validator = compressed->sha256;
+				if (indexCacheDirectory.empty()) result.body = std::move(body);
+				else
+					result.cachedFile = indexCache()->store(result.url, body, "", "", compressed->sha256);
+				return result;
+			}
+
+			// keep it decompressed, that's the form pdiffs apply to
+			imemstream compressedStream(body);
+			DecompressStream decompressed(compressedStream, variant, decompressThreads());
+			string text = streamToString(decompressed);
+			if (verifyChecksums && Sha256::of(text) != plain->sha256)
+				throw runtime_error("sha256 mismatch for " + plainUrl);
+			result.cachedFile = indexCache()->store(plainUrl, text, "", "", plain->sha256);
+			result.url = plainUrl;
+			result.validator = plain->sha256;
+			return result;
+		}
+
+		// Turns the cached index with hash `have` into the one Release lists by applying Packages.diff patches.
+		// Every download and the final result are verified, any mismatch throws and the caller refetches.
+		string patchIndex(const IndexSource& source, const ReleaseFile& release, string original, const string& have) {
+			string diffUrl = source.distUrl + "/" + source.path + ".diff/";
+			string indexText = downloadString(connectionPool, diffUrl + "Index");
+			if (Sha256::of(indexText) != release.find(source.path + ".diff/Index")->sha256)
+				throw runtime_error("sha256 mismatch for " + diffUrl + "Index");
+			auto index = PdiffIndex::parse(indexText);
+			if (index.current.sha256 != release.find(source.path)->sha256)
+				throw runtime_error("pdiff index does not match the Release file");
+
+			std::vector<const ChecksumEntry*> chain;
+			if (!index.chain(have, chain)) throw runtime_error("cached index is older than the pdiff history");
+
+			EdPatcher patcher(std::move(original));
+			uint64_t transferred = 0;
+			for (auto patch : chain) {
+				auto download = index.download(patch->name);
+				string file = download ? download->name : patch->name + ".gz";
+				string compressed = downloadString(connectionPool, diffUrl + file);
+				if (download && Sha256::of(compressed) != download->sha256)
+					throw runtime_error("sha256 mismatch for " + diffUrl + file);
+				transferred += compressed.size();
+
+				imemstream compressedStream(compressed);
+				DecompressStream decompressed(compressedStream, file, 1);
+				string script = streamToString(decompressed);
+				if (Sha256::of(script) != patch->sha256) throw runtime_error("sha256 mismatch for " + diffUrl + file);
+				patcher.apply(std::move(script));
+			}
+
+			string patched = patcher.result();
+			if (Sha256::of(patched) != index.current.sha256) throw runtime_error("patched index does not verify");
+			cout << "updated " + source.distUrl + "/" + source.path + " with " + to_string(chain.size()) + " pdiffs (" +
+						to_string(transferred + indexText.size()) + " bytes)\n";
+			return patched;
+		}
+
+		void parseIndex(const FetchedIndex& fetched, const string& baseUrl, PackageIndex& index) {
+			auto span = tracer.span("parse index", fetched.url);
+			MappedFile cachedFile;
+			if (!fetched.cachedFile.empty()) cachedFile.open(fetched.cachedFile);
+			imemstream compressedStream = cachedFile.isOpen() ? imemstream(cachedFile.data(), cachedFile.size())
+															  : imemstream(fetched.body);
+			DecompressStream decompressed(compressedStream, fetched.url, decompressThreads());
+
+			uint32_t prefix = index.addPrefix(baseUrl);
+			PackagesParser parser([&](std::string_view entry) { index.addStanza(prefix, entry); });
+
+			std::vector<char> chunk(1 << 16);
+			while (decompressed.read(chunk.data(), chunk.size()) || decompressed.gcount() > 0) {
+				parser.feed(chunk.data(), decompressed.gcount());
+			}
+			parser.finish();
+			cout << parser.count() << "\n";
+		}
+
+		// Adds the packages of `wanted` that own a file under one of prefixes to result, reading a Contents-<arch> index.
+		// Lines are "<path> <section>/<package>,<section>/<package>", only lines under a prefix get their list split.
+		void scanContents(
+			const FetchedIndex& fetched,
+			const vector<string>& prefixes,
+			const std::set<string>& wanted,
+			std::set<string>& result
+		) {
+			auto span = tracer.span("scan contents", fetched.url);
+			MappedFile cachedFile;
+			if (!fetched.cachedFile.empty()) cachedFile.open(fetched.cachedFile);
+			imemstream compressedStream = cachedFile.isOpen() ? imemstream(cachedFile.data(), cachedFile.size())
+															  : imemstream(fetched.body);
+			DecompressStream decompressed(compressedStream, fetched.url, decompressThreads());
+
+			auto scanLine = [&](std::string_view line) {
+				if (line.rfind("./", 0) == 0) line.remove_prefix(2);
+				bool under = false;
+				for (auto& prefix : prefixes) {
+					if (line.size() > prefix.size() && line.compare(0, prefix.size(), prefix) == 0 &&
+						(line[prefix.size()] == '/' || line[prefix.size()] == ' ' || line[prefix.size()] == '\t')) {
+						under = true;
+						break;
+					}
+				}
+				if (!under) return;
+				size_t listStart = line.find_last_of(" \t");
+				if (listStart == std::string_view::npos) return;
+				for (auto& owner : split(string(line.substr(listStart + 1)), ",")) {
+					string name = owner.substr(owner.rfind('/') + 1);
+					if (wanted.count(name)) result.insert(name);
+				}
+			};
+
+			string pending;
+			std::vector<char> chunk(1 << 16);
+			while (decompressed.read(chunk.data(), chunk.size()) || decompressed.gcount() > 0) {
+				pending.append(chunk.data(), decompressed.gcount());
+				size_t start = 0, eol;
+				while ((eol = pending.find('\n', start)) != string::npos) {
+					scanLine(std::string_view(pending).substr(start, eol - start));
+					start = eol + 1;
+				}
+				pending.erase(0, start);
+			}
+			if (!pending.empty()) scanLine(pending);
+		}
+
+		// The packages of plan that put at least one file under a requested source path, going by the Contents-<arch>
+		// indexes of every distribution. Returns false when that can't be known (a distribution without Contents,
+		// or a location extracting the whole archive), nothing may be pruned then.
+		bool contributingPackages(
+			const vector<PlannedPackage>& plan,
+			const std::set<std::pair<std::string, std::string>>& locations,
+			std::set<string>& result
+		) {
+			vector<string> prefixes;
+			for (auto& [source, destination] : locations) {
+				prefixes.push_back(normalizeTarPath(source));
+				if (prefixes.back().empty()) return false;
+			}
+			std::set<string> wanted;
+			for (auto& planned : plan) wanted.insert(planned.name);
+
+			// Contents are per component in current Debian and per distribution in Ubuntu
+			string arch = architecture.substr(architecture.rfind('-') + 1);
+			std::set<string> urls;
+			for (auto& source : indexSources) {
+				auto release = releaseFiles.find(source.distUrl);
+				if (release == releaseFiles.end()) return false;
+				string component = source.path.substr(0, source.path.find('/'));
+				string variant = release->second.pickVariant(component + "/Contents-" + arch);
+				if (variant.empty()) variant = release->second.pickVariant("Contents-" + arch);
+				if (variant.empty()) return false;
+				urls.insert(source.distUrl + "/" + variant);
+			}
+
+			Scheduler::Group group;
+			auto scope = pipeline().enter(group);
+			std::mutex resultMtx;
+			for (auto& url : urls) {
+				pipeline().io(Scheduler::Fetch, [=, &prefixes, &wanted, &result, &resultMtx]() {
+					auto fetched = std::make_shared<FetchedIndex>(fetchIndex(url));
+					pipeline().cpu(Scheduler::Parse, [=, &prefixes, &wanted, &result, &resultMtx]() {
+						std::set<string> found;
+						scanContents(*fetched, prefixes, wanted, found);
+						std::lock_guard<std::mutex> lock(resultMtx);
+						result.insert(found.begin(), found.end());
+					});
 				});
 			}
-			trm.wait();
+			pipeline().wait();
+			return true;
+		}
+
+		// Identifies the exact set of indexes the package index was built from, empty if any of them can't be revalidated.
+		string indexSnapshotKey(const vector<IndexSource>& sources, const vector<FetchedIndex>& fetched) {
+			if (indexCacheDirectory.empty()) return "";
+			string key = architecture + "\n";
+			for (size_t i = 0; i < sources.size(); i++) {
+				if (!fetched[i].ok || fetched[i].validator.empty()) return "";
+				key += sources[i].distUrl + "/" + sources[i].path + " " + fetched[i].validator + "\n";
+			}
+			return key;
+		}
+
+		// Links the repositories of index with those already in merged that list a package at the same path with
+		// the same SHA256, they serve the same pool.
+		void linkMirrors(const PackageIndex& merged, const PackageIndex& index) {
+			for (size_t i = 0; i < index.packagesSize(); i++) {
+				auto& pkg = index.package(i);
+				auto* known = merged.find(index.str(pkg.name));
+				if (!known || index.prefix(pkg) == merged.prefix(*known)) continue;
+				if (PackageIndex::sha256(pkg).empty() || std::memcmp(pkg.sha256, known->sha256, sizeof(pkg.sha256)) != 0)
+					continue;
+				if (index.str(pkg.path) != merged.str(known->path)) continue;
+				// downloads can't fail over between the network and a local directory
+				string a(merged.prefix(*known)), b(index.prefix(pkg));
+				if (!localPath(a).empty() || !localPath(b).empty()) continue;
+				if (mirrors.sameGroup(a, b)) continue;
+				mirrors.link(a, b);
+				cout << "detected mirror " << b << " of " << a << "\n";
+			}
+		}
+
+		// What fetching and parsing the index of source holds in memory at most, the compressed download and its
+		// decompressed text. 0 when the Release file doesn't list their sizes.
+		static uint64_t indexMemory(const IndexSource& source, const ReleaseFile& release) {
+			string variant = release.pickVariant(source.path);
+			if (variant.empty()) return 0;
+			const ChecksumEntry* plain = release.find(source.path);
+			return release.find(variant)->size + (plain ? plain->size : 0);
+		}
+
+		void getPackageList() { usePackageList(fetchPackageList()); }
+
+		// Fetches and parses every source into a new index, packageIndex isn't touched.
+		PackageList fetchPackageList() {
+			Scheduler::Group group;
+			auto scope = pipeline().enter(group);
+			PackageList list;
+			auto& sources = list.sources = getIndexSources();
+			// one Release file per distribution, shared by all of its components
+			auto& releases = list.releases;
+			for (auto& source : sources) releases[source.distUrl];
+			for (auto& entry : releases) {
+				string distUrl = entry.first;
+				ReleaseFile* release = &entry.second;
+				pipeline().io(Scheduler::Fetch, [=]() { *release = fetchRelease(distUrl); });
+			}
+			pipeline().wait();
+
+			std::vector<FetchedIndex> fetched(sources.size());
+			std::vector<PackageIndex> perSource(sources.size());
+			std::vector<char> parsed(sources.size(), false);
+			std::atomic_int32_t successfulSources = 0;
+			for (size_t k = 0; k < sources.size(); k++) {
+				auto& release = releases.at(sources[k].distUrl);
+				pipeline().io(
+					Scheduler::Fetch,
+					budget,
+					{0, indexMemory(sources[k], release)},
+					[=, &fetched, &perSource, &parsed, &successfulSources, &release, this](Budget::Lease lease) {
+						string listUrl = sources[k].distUrl + "/" + sources[k].path;
+						try {
+							auto span = tracer.span("fetch index", listUrl);
+							fetched[k] = fetchPackages(sources[k], release);
+							// cached, patched and local indexes are parsed from their file, counted by its size
+							std::error_code ec;
+							uint64_t size = fetched[k].body.empty() ? fs::file_size(fetched[k].cachedFile, ec)
+																	: fetched[k].body.size();
+							tracer.count(Tracer::IndexBytes, ec ? 0 : size);
+							successfulSources++;
+						} catch (...) {
+							std::string errm = "Failed to fetch URL " + listUrl;
+							if (throwOnFailedSourceURL) throw std::runtime_error(errm);
+							cout << errm;
+							return;
+						}
+						// only indexes fetched without an index cache stay in memory, and those never have a snapshot to
+						// load instead, so they are parsed right away and give their memory back when done
+						if (fetched[k].body.empty()) return;
+						parsed[k] = true;
+						pipeline().cpu(Scheduler::Parse, [=, &fetched, &perSource, this]() {
+							parseIndex(fetched[k], sources[k].baseUrl, perSource[k]);
+							fetched[k].body = "";
+							(void)lease;// keeps the memory accounted until here
+						});
+					}
+				);
+			}
+			pipeline().wait();
 			if (successfulSources == 0)
 				throw std::runtime_error("All sources urls failed to fetch / or none were provided.");
-			for (auto& m : packageToUrlMaps) { packageToUrl.insert(m.begin(), m.end()); }
-			// for(const auto& elem : packageToUrl){
-			//     cout << elem.first << " -> " << elem.second << "\n";
-			// }
-		}
-		vector<string> getFields(const string& contolFile, string typeOfDep = "Depends") {
-			vector<string> result;
-			map<string, boost::regex> rgx;
-			if (!rgx.count(typeOfDep))
-				rgx[typeOfDep] = boost::regex(typeOfDep + ": ?([^\\r\\n]*)", boost::regex::optimize);
-			string depends;
-			{
-				boost::smatch matches;
-				if (boost::regex_search(contolFile, matches, rgx[typeOfDep]) && matches.size() == 2) {
-					depends = string(matches[1]);
-				} else {
-					return result;
-				}
+
+			// nothing changed upstream since the snapshot was written, map it instead of parsing again
+			string snapshotKey = indexSnapshotKey(sources, fetched);
+			auto snapshotFile = indexCacheDirectory / "packages.idx";
+			if (!snapshotKey.empty() && list.index.load(snapshotFile, snapshotKey)) {
+				cout << "loaded package index snapshot " << snapshotFile.string() << "\n";
+				mirrors.load(indexCacheDirectory / "mirrors");
+				return list;
 			}
-			auto entries = split(depends, ",|\\|");
-			boost::regex r("(?:\\s+)|(?:\\(.*\\))|(?::.*)", boost::regex::optimize);
-			for (auto entry : entries) {
-				// (\S+)\s?(?:\((\S*)\s?(\S*)\))?
-				result.push_back(boost::regex_replace(entry, r, ""));
+
+			for (size_t k = 0; k < sources.size(); k++) {
+				if (!fetched[k].ok || parsed[k]) continue;
+				pipeline().cpu(Scheduler::Parse, [=, &fetched, &perSource, this]() {
+					parseIndex(fetched[k], sources[k].baseUrl, perSource[k]);
+					fetched[k].body = "";
+				});
 			}
-			return result;
+			pipeline().wait();
+
+			for (auto& index : perSource) {
+				if (detectMirrors) linkMirrors(list.index, index);
+				list.index.merge(index);
+			}
+			if (!snapshotKey.empty()) {
+				list.index.save(snapshotFile, snapshotKey);
+				mirrors.save(indexCacheDirectory / "mirrors");
+			}
+			return list;
 		}
-		void installPrivate(
-			string package, std::set<std::pair<std::string, std::string>> locations, int recursionDepth
+
+		// Makes list the index lookups and resolution go through. The sources and Release files are kept for the
+		// Contents lookups of pruneWithContents.
+		void usePackageList(PackageList list) {
+			graph.reset();
+			packageIndex = std::move(list.index);
+			indexSources = std::move(list.sources);
+			releaseFiles = std::move(list.releases);
+		}
+
+		vector<string> getFields(const string& contolFile, string typeOfDep = "Depends") {
+			return splitDependencyNames(findField(contolFile, typeOfDep));
+		}
+		// "./usr/lib/" -> "usr/lib", tar::Reader style sources and entry names compare equal after this
+		static string normalizeTarPath(string path) {
+			while (path.rfind("./", 0) == 0 || path.rfind("/", 0) == 0) path.erase(0, path[0] == '.' ? 2 : 1);
+			if (path == ".") path = "";
+			while (!path.empty() && path.back() == '/') path.pop_back();
+			return path;
+		}
+
+		// Where an archive entry lands relative to a destination, false if it is outside source or escapes upwards.
+		static bool mapTarPath(const string& name, const string& source, string& relative) {
+			if (source.empty()) relative = name;
+			else if (name == source)
+				relative = "";
+			else if (name.size() > source.size() && name.compare(0, source.size(), source) == 0 && name[source.size()] == '/')
+				relative = name.substr(source.size() + 1);
+			else
+				return false;
+			for (auto& part : fs::path(relative))
+				if (part == "..") return false;
+			return true;
+		}
+
+		static void writeWhole(const fs::path& path, const string& content) {
+			// replace instead of writing through, the old file may be a symlink or share its inode with a hard link
+			std::error_code ec;
+			if (fs::is_symlink(path, ec) || fs::exists(path, ec)) fs::remove(path, ec);
+			ofstream out(path, ios::binary | ios::trunc);
+			out.write(content.data(), content.size());
+			if (!out) throw runtime_error("could not write " + path.string());
+		}
+
+		// Extracts data.tar entry by entry, records every file and symlink per destination and leaves files
+		// whose contents match what the previous version of the package installed untouched.
+		// The records are returned rather than put into manifests, see commitManifests().
+		ManifestRecords extractTarIncremental(
+			istream& tarStream,
+			const string& package,
+			const string& packageId,
+			const std::set<std::pair<std::string, std::string>>& locations
 		) {
-			string url;
-			vector<std::thread> threads;
-			std::shared_ptr<void> _(nullptr, bind([&] {
-										unique_lock<mutex> lock(installLock);
-										currentlyInstallingList.erase(package);
-									}));
+			const uint64_t inMemoryLimit = 1 << 20;
+			ManifestRecords records;
+			std::map<string, std::map<string, ManifestFile>> previous;
 			{
-				unique_lock<mutex> lock(installLock);
-				currentlyInstallingList.insert(package);
-				liveViewInstalling << estd::clearScreen << estd::moveCursor(0, 0);
-				for (auto pkg : currentlyInstallingList) {
-					liveViewInstalling << estd::setTextColor(0, 255, 0) << pkg << estd::clearSettings << "\n";
+				std::lock_guard<std::mutex> lock(manifestMtx);
+				for (auto& [source, destination] : locations) {
+					records[destination] = {package, packageId, {}};
+					auto old = manifests[destination].find(package);
+					if (old)
+						for (auto& file : old->files) previous[destination][file.path] = file;
 				}
+			}
+			// the previous version had the same contents, what is on disk still has to be checked
+			auto sameHash = [&](const string& destination, const string& relative, const string& sha256,
+								uint64_t size) {
+				auto& old = previous[destination];
+				auto it = old.find(relative);
+				return it != old.end() && it->second.sha256 == sha256 && it->second.size == size;
+			};
+			auto unchanged = [sameHash](const string& destination, const string& relative, const string& sha256,
+										uint64_t size) {
+				std::error_code ec;
+				return sameHash(destination, relative, sha256, size) &&
+					   !fs::is_symlink(fs::path(destination) / relative, ec) &&
+					   fs::file_size(fs::path(destination) / relative, ec) == size && !ec;
+			};
 
-				if (!packageToUrl.count(package)) {
-					if (throwOnFailedDependency)
-						throw runtime_error("package " + package + " does not exist in repository.");
-					return;
+			// small files are written by the writer threads while decoding goes on, links and permissions wait
+			// for batch.finish()
+			FileWriter::Batch batch(fileWriter());
+			TarStreamReader tar(tarStream);
+			TarStreamReader::Entry entry;
+			string content;
+			std::vector<char> chunk(1 << 20);
+			while (tar.next(entry)) {
+				string name = normalizeTarPath(entry.name);
+				std::vector<std::pair<string, string>> targets;// destination, relative path
+				for (auto& [source, destination] : locations) {
+					string relative;
+					if (mapTarPath(name, normalizeTarPath(source), relative)) targets.push_back({destination, relative});
 				}
-				url = packageToUrl[package];
+				if (targets.empty()) continue;
+
+				uint32_t mode = (entry.mode & 07777) | minPermissions;
+				if (entry.type == TarStreamReader::Entry::Directory) {
+					for (auto& [destination, relative] : targets) batch.directories(fs::path(destination) / relative);
+				} else if (entry.type == TarStreamReader::Entry::Symlink) {
+					for (auto& [destination, relative] : targets) {
+						fs::path path = fs::path(destination) / relative;
+						batch.directories(path.parent_path());
+						batch.later([path, linkTarget = entry.linkTarget] {
+							std::error_code ec;
+							if (fs::read_symlink(path, ec) != linkTarget || ec) {
+								fs::remove(path, ec);
+								fs::create_symlink(linkTarget, path);
+							}
+						});
+						records[destination].files.push_back({relative, 0, 0, "", entry.linkTarget});
+					}
+				} else if (entry.type == TarStreamReader::Entry::Hardlink) {
+					string linked = normalizeTarPath(entry.linkTarget);
+					for (auto& [source, destination] : locations) {
+						string relative, linkedRelative;
+						if (!mapTarPath(name, normalizeTarPath(source), relative) ||
+							!mapTarPath(linked, normalizeTarPath(source), linkedRelative))
+							continue;
+						auto& files = records[destination].files;
+						auto original = std::find_if(files.begin(), files.end(), [&](auto& f) { return f.path == linkedRelative; });
+						if (original == files.end()) continue;// target outside this location, like tar::Reader skip it
+						ManifestFile file = *original;
+						file.path = relative;
+						fs::path path = fs::path(destination) / relative;
+						fs::path linkedPath = fs::path(destination) / linkedRelative;
+						batch.directories(path.parent_path());
+						// the file it links to may still be queued
+						batch.later([=, destination = destination] {
+							if (unchanged(destination, relative, file.sha256, file.size)) return;
+							std::error_code ec;
+							fs::remove(path, ec);
+							fs::create_hard_link(linkedPath, path, ec);
+							if (ec) fs::copy_file(linkedPath, path);
+						});
+						files.push_back(file);
+					}
+				} else if (entry.type == TarStreamReader::Entry::File) {
+					Sha256 hash;
+					fs::path tmp;
+					if (entry.size <= inMemoryLimit) {
+						content.resize(entry.size);
+						tar.stream().read(content.data(), entry.size);
+						if (uint64_t(tar.stream().gcount()) != entry.size) throw runtime_error("truncated " + name);
+						hash.update(content.data(), content.size());
+					} else {
+						// too big to hold, stream it next to the first target and decide once the hash is known.
+						// Its blocks are reserved up front so the file doesn't grow chunk by chunk
+						tmp = (fs::path(targets[0].first) / targets[0].second).string() + ".deb-part";
+						batch.directories(tmp.parent_path());
+						int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+						if (fd < 0) throw runtime_error("could not create " + tmp.string());
+						std::shared_ptr<void> _(nullptr, bind([&] { ::close(fd); }));
+						// best effort, it only keeps the file in one piece: without room the writes below fail anyway
+						(void)::posix_fallocate(fd, 0, off_t(entry.size));
+						uint64_t offset = 0;
+						while (tar.stream().read(chunk.data(), chunk.size()) || tar.stream().gcount() > 0) {
+							hash.update(chunk.data(), tar.stream().gcount());
+							writeAt(fd, chunk.data(), tar.stream().gcount(), offset);
+							offset += tar.stream().gcount();
+						}
+						if (offset != entry.size) {
+							std::error_code ec;
+							fs::remove(tmp, ec);
+							throw runtime_error("truncated " + name);
+						}
+					}
+					string sha256 = hash.hex();
+
+					// the first target last, it may take the temporary file over
+					for (size_t i = targets.size(); i-- > 0;) {
+						auto& [destination, relative] = targets[i];
+						fs::path path = fs::path(destination) / relative;
+						if (tmp.empty()) {
+							bool keep = sameHash(destination, relative, sha256, entry.size);
+							batch.write(path, i == 0 ? std::move(content) : content, keep);
+						} else if (unchanged(destination, relative, sha256, entry.size)) {
+							tracer.count(Tracer::FilesUnchanged, 1);
+						} else {
+							batch.directories(path.parent_path());
+							std::error_code ec;
+							if (fs::is_symlink(path, ec)) fs::remove(path, ec);
+							if (i == 0) fs::rename(tmp, path);
+							else
+								fs::copy_file(tmp, path, fs::copy_options::overwrite_existing);
+							tracer.count(Tracer::FilesWritten, 1);
+						}
+						batch.later([path, mode] { fs::permissions(path, fs::perms(mode)); });
+						records[destination].files.push_back({relative, mode, entry.size, sha256, ""});
+					}
+					std::error_code ec;
+					if (!tmp.empty()) fs::remove(tmp, ec);
+				}
+			}
+			auto span = tracer.span("write-out", package);
+			batch.finish();
+			span.end();
+			return records;
+		}
 
-				if (installed.count(url)) {
-					cout << "already installed " + package + "\n";
-					return;
+		// Records a verified package in manifests and removes the files its previous version had and it dropped.
+		// Until then the previous records stay, an install that fails its checksum is redone in full next time.
+		void commitManifests(ManifestRecords records) {
+			std::lock_guard<std::mutex> lock(manifestMtx);
+			for (auto& [destination, record] : records) {
+				for (auto& stale : manifests[destination].replace(std::move(record))) {
+					std::error_code ec;
+					fs::remove(fs::path(destination) / stale, ec);
 				}
+			}
+		}
 
-				installed.insert(url);
-				cout << "installed " + package + "\n";
+		// Walks a .deb front to back (debian-binary, control.tar.*, data.tar.*) without ever seeking,
+		// extracting data.tar into locations. Returns what the manifests should record once the .deb is verified.
+		ManifestRecords extractDeb(
+			istream& debStream,
+			const string& package,
+			const string& packageId,
+			const std::set<std::pair<std::string, std::string>>& locations,
+			ProgressEntry& progressEntry
+		) {
+			// up to the data member, in streaming mode this includes waiting for the first bytes
+			auto arSpan = tracer.span("ar open", package);
+			ArStreamReader deb(debStream);
+			ArStreamReader::Member member;
+			ManifestRecords records;
+			bool foundData = false;
+			while (deb.next(member)) {
+				if (member.name == "debian-binary") {
+					string version = streamToString(deb.stream());
+					if (version.find("2.0") == string::npos)
+						throw runtime_error("package " + package + " has a bad version number " + version + ".");
+				} else if (member.name.rfind("data.tar", 0) == 0) {
+					arSpan.end();
+					progressEntry.phase = ProgressEntry::Extracting;
+					auto span = tracer.span("extract", package);
+					// decoding happens inside the tar reader's reads, the wrappers split it out as its own phase and
+					// cut the waits for the compressed bytes out of it
+					std::unique_ptr<WaitStreambuf> waits;
+					std::istream compressed(deb.stream().rdbuf());
+					if (tracer.enabled) {
+						waits = std::make_unique<WaitStreambuf>(deb.stream().rdbuf(), tracer, package);
+						compressed.rdbuf(waits.get());
+					}
+					DecompressStream decompressed(compressed, member.name, decompressThreads());
+					std::unique_ptr<TracedStreambuf> traced;
+					if (waits) {
+						traced = std::make_unique<TracedStreambuf>(decompressed.rdbuf(), tracer, "decompress", package);
+						waits->interrupts(traced.get());
+					}
+					std::istream dataTarStream(traced ? traced.get() : decompressed.rdbuf());
+					if (incrementalInstall && !extractHardLinksAsCopies && !extractSoftLinksAsCopies) {
+						records = extractTarIncremental(dataTarStream, package, packageId, locations);
+						tracer.count(Tracer::Packages, 1);
+						foundData = true;
+						break;
+					}
+					tar::Reader dataTar(dataTarStream);
+					dataTar.throwOnUnsupported = false;
+					dataTar.extractHardLinksAsCopies = extractHardLinksAsCopies;
+					dataTar.extractSoftLinksAsCopies = extractSoftLinksAsCopies;
+					dataTar.throwOnInfiniteRecursion = false;
+					dataTar.throwOnBrokenSoftlinks = false;
+					dataTar.minPermissions = minPermissions;
+
+					for (auto [source, destination] : locations) { dataTar.extractPath(source, destination); }
+					// links copied as files can't be tracked per file, the manifest only remembers the version
+					if (incrementalInstall)
+						for (auto [source, destination] : locations) records[destination] = {package, packageId, {}};
+					tracer.count(Tracer::Packages, 1);
+					foundData = true;
+					// data is the last member, don't wait for anything the producer might still send
+					break;
+				}
 			}
+			if (!foundData) throw runtime_error("package " + package + " has no data.tar member.");
+			return records;
+		}
+
+		fs::path cachedDeb(const string& sha256) {
+			if (debCacheDirectory.empty() || sha256.empty()) return "";
+			DebCache cache(debCacheDirectory);
+			return cache.contains(sha256) ? cache.pathFor(sha256) : "";
+		}
 
-			auto packageLoc = downloadFile(url, tmpDirectory->path());
-			ar::Reader deb(packageLoc.string());
+		// Returns the .deb at url as a local file, from debCacheDirectory when possible (non streaming installs).
+		fs::path fetchDeb(const string& url, const string& sha256, uint64_t size) {
+			fs::path local = localPath(url);
+			if (!local.empty()) return local;
+			bool cacheable = !debCacheDirectory.empty() && !sha256.empty();
+			DebCache cache(debCacheDirectory);
+			if (cacheable && cache.contains(sha256)) return cache.pathFor(sha256);
+
+			bool verify = (verifyChecksums || cacheable) && !sha256.empty();
+			Sha256 hash;
+			auto span = tracer.span("download", url);
+			auto file = downloadFile(
+				connectionPool,
+				url,
+				tmpDirectory->path(),
+				size,
+				parallelDownloads,
+				parallelDownloadThreshold,
+				verify ? &hash : nullptr
+			);
+			span.end();
+			if (verify && hash.hex() != sha256) throw runtime_error("sha256 mismatch for " + url);
+			if (cacheable) return cache.adopt(file, sha256);
+			return file;
+		}
 
-			auto versionStream = deb.open("debian-binary");
-			string version = streamToString(versionStream);
-			if (version.find("2.0") == string::npos)
-				throw runtime_error("package " + package + " has a bad version number " + version + ".");
+		// Runs on the io pool. Downloads the .deb at url straight into an extract task on the cpu pool through a pipe,
+		// so nothing is written to tmpDirectory and extraction overlaps with the transfer.
+		// With debCacheDirectory set the body is also teed into the cache.
+		void streamDeb(
+			const string& url,
+			const string& sha256,
+			const string& package,
+			const std::set<std::pair<std::string, std::string>>& locations,
+			ProgressEntry& progressEntry
+		) {
+			std::unique_ptr<DebCache> cache;
+			if (!debCacheDirectory.empty() && !sha256.empty()) cache = std::make_unique<DebCache>(debCacheDirectory);
+			// the hash is computed on the bytes as they stream past, verification costs no extra pass
+			bool verify = (verifyChecksums || cache) && !sha256.empty();
+
+			int numRetry = 3;
+			for (int i = 1;; i++) {
+				PipeStreambuf pipe(streamBufferSize);
+				auto extracted = std::make_shared<std::promise<ManifestRecords>>();
+				auto done = extracted->get_future();
+				progressEntry.bytes = 0;
+				progressEntry.phase = ProgressEntry::Downloading;
+
+				// submitted by the running download, so an extract task never waits for a producer that hasn't started
+				pipeline().cpu(Scheduler::Extract, [&, extracted] {
+					try {
+						std::istream debStream(&pipe);
+						auto records =
+							extractDeb(debStream, package, sha256.empty() ? url : sha256, locations, progressEntry);
+						// everything has to pass through the hash before the package counts as verified
+						if (verify) {
+							debStream.clear();
+							debStream.ignore(std::numeric_limits<std::streamsize>::max());
+						}
+						pipe.cancel();
+						extracted->set_value(std::move(records));
+					} catch (...) {
+						pipe.cancel();
+						extracted->set_exception(std::current_exception());
+					}
+				});
 
-			string controlString;
+				bool complete = false;
+				try {
+					Sha256 hash;
+					auto writer = cache ? cache->write(sha256) : nullptr;
+					auto span = tracer.span("download", package);
+					downloadResumable(connectionPool, url, 0, 0, [&](const char* data, size_t size) {
+						if (verify) hash.update(data, size);
+						if (writer) writer->write(data, size);
+						progressEntry.bytes += size;
+						return pipe.write(data, size);
+					});
+					if (verify) {
+						auto actual = hash.hex();
+						if (actual != sha256) throw runtime_error("sha256 mismatch for " + url);
+						if (writer) writer->commit(actual);
+					}
+					complete = true;
+					pipe.close();
+				} catch (...) { pipe.fail(std::current_exception()); }
 
-			estd::isubstream dataTarCompressedStream;
-			for (auto path : {"data.tar.xz", "data.tar.gz", "data.tar.zst", "data.tar.bz2", "data.tar"}) {
 				try {
-					dataTarCompressedStream = deb.open(path);
-					break;
-				} catch (...) {}
+					auto records = done.get();
+					pipe.rethrowIfFailed();
+					if (verify && !complete) throw runtime_error("download of " + url + " was cut short");
+					// only now the files are known to come from the package the index lists
+					commitManifests(std::move(records));
+					return;
+				} catch (...) {
+					// a failed attempt restarts from scratch, extraction simply overwrites what the previous one wrote
+					// and its records are dropped
+					if (i == numRetry) throw;
+				}
 			}
+		}
 
-			bxz::istream dataTarStream(dataTarCompressedStream);
-			tar::Reader dataTar(dataTarStream);
-			dataTar.throwOnUnsupported = false;
-			dataTar.extractHardLinksAsCopies = extractHardLinksAsCopies;
-			dataTar.extractSoftLinksAsCopies = extractSoftLinksAsCopies;
-			dataTar.throwOnInfiniteRecursion = false;
-			dataTar.throwOnBrokenSoftlinks = false;
-			dataTar.minPermissions = minPermissions;
-
-			for (auto [source, destination] : locations) { dataTar.extractPath(source, destination); }
+		// resolve() against the packages installed so far
+		vector<PlannedPackage> resolve(const vector<string>& roots, int depthLimit, bool everything = false) {
+			return resolve(roots, depthLimit, installed, everything);
+		}
 
+		// Computes what installing roots takes from the index alone, before anything is downloaded.
+		// Dependencies are followed breadth first down to depthLimit levels (the first level being the roots),
+		// packages whose url is in installedUrls are left out together with their dependencies.
+		// An alternative group "a | b" is satisfied by a member that is already installed or picked, otherwise by its
+		// first member the index knows. With everything set, every alternative, Recommends and Suggests are followed
+		// (this is only used to measure what the selection saves). The names left out as installed go to
+		// alreadyInstalled when given, nothing is printed.
+		// Only reads the index, once dependencyGraph() is compiled in full any number of these can run at once.
+		vector<PlannedPackage> resolve(
+			const vector<string>& roots,
+			int depthLimit,
+			const std::set<string>& installedUrls,
+			bool everything = false,
+			vector<string>* alreadyInstalled = nullptr
+		) {
+			auto& graph = dependencyGraph();
+			vector<PlannedPackage> plan;
+			// by package id: picked by this resolution, and whether installedUrls has it (urls are what outlives the
+			// index, each package's url is built at most once)
+			std::vector<bool> seen(packageIndex.packagesSize(), false);
+			std::vector<uint8_t> installedState(installedUrls.empty() ? 0 : packageIndex.packagesSize(), 0);
+			std::deque<std::tuple<std::string_view, uint32_t, int>> queue;
+
+			auto wasInstalled = [&](uint32_t id) {
+				if (installedUrls.empty()) return false;
+				if (installedState[id] == 0)
+					installedState[id] = installedUrls.count(packageIndex.url(packageIndex.package(id))) ? 2 : 1;
+				return installedState[id] == 2;
+			};
+			auto isInstalled = [&](uint32_t id) { return seen[id] || wasInstalled(id); };
+			// breadth first, so the first time a package is queued is also its shallowest depth
+			auto enqueue = [&](std::string_view name, uint32_t id, int depth) {
+				if (id == DependencyGraph::unknown) return false;
+				if (seen[id]) return true;
+				seen[id] = true;
+				if (wasInstalled(id)) {
+					if (alreadyInstalled) alreadyInstalled->emplace_back(name);
+					return true;
+				}
+				queue.emplace_back(name, id, depth);
+				return true;
+			};
+			auto missing = [&](const string& what) {
+				if (throwOnFailedDependency && !everything)
+					throw runtime_error("package " + what + " does not exist in repository.");
+			};
 
-			if (recursionDepth <= 1) return;
+			for (auto& root : roots) {
+				if (root.empty()) continue;
+				auto* pkg = packageIndex.find(root);
+				if (!enqueue(root, pkg ? packageIndex.id(*pkg) : DependencyGraph::unknown, depthLimit)) missing(root);
+			}
+			while (!queue.empty()) {
+				auto [name, id, depth] = queue.front();
+				queue.pop_front();
+				auto& pkg = packageIndex.package(id);
+				// under its own name, not the Provides or Source alias it was reached through
+				plan.push_back(
+					{string(packageIndex.str(pkg.name)), packageIndex.url(pkg), PackageIndex::sha256(pkg), pkg.size}
+				);
+
+				if (depth <= 1) continue;
+				vector<DependencyGraph::Field> fields = {DependencyGraph::PreDepends, DependencyGraph::Depends};
+				if (everything || followRecommends) fields.push_back(DependencyGraph::Recommends);
+				if (everything || followSuggests) fields.push_back(DependencyGraph::Suggests);
+				for (auto field : fields) {
+					graph.forEachGroup(id, field, [&](auto begin, auto end) {
+						if (everything) {
+							for (auto alternative = begin; alternative != end; alternative++)
+								enqueue(alternative->name, alternative->package, depth - 1);
+							return;
+						}
 
-			estd::isubstream controlTarCompressedStream;
-			for (auto path :
-				 {"control.tar.xz", "control.tar.gz", "control.tar.zst", "control.tar.bz2", "control.tar"}) {
-				try {
-					controlTarCompressedStream = deb.open(path);
-					break;
-				} catch (...) {}
+						bool satisfied = false;
+						for (auto alternative = begin; alternative != end; alternative++) {
+							auto candidate = alternative->package;
+							if (candidate != DependencyGraph::unknown && isInstalled(candidate)) satisfied = true;
+						}
+						for (auto alternative = begin; alternative != end && !satisfied; alternative++)
+							satisfied = enqueue(alternative->name, alternative->package, depth - 1);
+						if (!satisfied) {
+							string names;
+							for (auto alternative = begin; alternative != end; alternative++)
+								names += (names.empty() ? "" : " | ") + string(alternative->name);
+							missing(names);
+						}
+					});
+				}
 			}
+			return plan;
+		}
 
-			bxz::istream controlTarStream(controlTarCompressedStream);
-			tar::Reader controlTar(controlTarStream);
-			auto controlFile = controlTar.open("control");
-			controlString = streamToString(controlFile);
+		// The graph of the current packageIndex, rebuilt whenever the index was.
+		DependencyGraph& dependencyGraph() {
+			if (!graph || !graph->matches(packageIndex)) graph = std::make_unique<DependencyGraph>(packageIndex);
+			return *graph;
+		}
 
-			// https://stackoverflow.com/a/3177252
-			const auto combineVectors = [](std::vector<std::string>& A, std::vector<std::string> B) {
-				std::vector<std::string> AB;
-				AB.reserve(A.size() + B.size());// preallocate memory
-				AB.insert(AB.end(), A.begin(), A.end());
-				AB.insert(AB.end(), B.begin(), B.end());
-				return AB;
-			};
+		// Compares the closure resolve() picked with the one following every alternative, Recommends and Suggests.
+		ResolutionReport reportResolution(
+			const vector<string>& roots,
+			const vector<PlannedPackage>& plan,
+			const std::set<string>& installedUrls
+		) {
+			ResolutionReport report;
+			report.packages = plan.size();
+			for (auto& planned : plan) report.bytes += planned.size;
+			auto everything = resolve(roots, recursionLimit, installedUrls, true);
+			report.unfilteredPackages = everything.size();
+			for (auto& planned : everything) report.unfilteredBytes += planned.size;
+			return report;
+		}
 
-			// cout << "\n" << controlString << "\n";
-			auto deps = getFields(controlString, "Depends");
-			deps = combineVectors(deps, getFields(controlString, "Recommends"));
-			deps = combineVectors(deps, getFields(controlString, "Suggests"));
-			deps = combineVectors(deps, getFields(controlString, "Pre-Depends"));
+		// Cached packages go straight to the cpu pool, everything else starts as a download on the io pool once budget
+		// has room for it, smallest packages first.
+		static string packageId(const PlannedPackage& planned) { return planned.sha256.empty() ? planned.url : planned.sha256; }
 
-			for (auto dep : deps) {
-				trm.schedule([this, dep, locations, recursionDepth]() {
-					this->installPrivate(dep, locations, recursionDepth - 1);
+		void saveManifests(const std::set<string>& destinations) {
+			std::lock_guard<std::mutex> lock(manifestMtx);
+			for (auto& destination : destinations) manifests[destination].save();
+		}
+
+		void installPrivate(PlannedPackage planned, std::set<std::pair<std::string, std::string>> locations) {
+			cout << "installed " + planned.name + "\n";
+			auto progressEntry = progress.begin(planned.name, planned.size);
+			// mapped rather than read, the ar, decompression and tar readers work on the page cache directly
+			auto extractFile = [this, planned, locations, progressEntry](fs::path file, string verifySha256) {
+				std::shared_ptr<void> _(nullptr, bind([&] { progress.end(progressEntry); }));
+				MappedFile mapped(file);
+				if (!verifySha256.empty()) {
+					Sha256 hash;
+					hash.update(mapped.data(), mapped.size());
+					if (hash.hex() != verifySha256) throw runtime_error("sha256 mismatch for " + file.string());
+				}
+				imemstream debFile(mapped.data(), mapped.size());
+				// a file on disk was verified before it got here, by fetchDeb, the cache or the check above
+				commitManifests(extractDeb(debFile, planned.name, packageId(planned), locations, *progressEntry));
+			};
+
+			fs::path local = localPath(planned.url);
+			fs::path cached = cachedDeb(planned.sha256);
+			if (!local.empty()) {
+				pipeline().cpu(Scheduler::Extract, [=] { extractFile(local, verifyChecksums ? planned.sha256 : ""); });
+			} else if (!cached.empty()) {
+				pipeline().cpu(Scheduler::Extract, [=] { extractFile(cached, ""); });
+			} else if (streamingInstall && !(parallelDownloads > 1 && planned.size >= parallelDownloadThreshold)) {
+				// the pipe buffer is what a streamed package holds in memory, it is extracted before the lease ends
+				pipeline().io(Scheduler::Download, budget, {planned.size, streamBufferSize}, [=](Budget::Lease) {
+					std::shared_ptr<void> _(nullptr, bind([&] { progress.end(progressEntry); }));
+					streamDeb(planned.url, planned.sha256, planned.name, locations, *progressEntry);
+				});
+			} else {
+				pipeline().io(Scheduler::Download, budget, {planned.size, 0}, [=](Budget::Lease lease) {
+					progressEntry->phase = ProgressEntry::Downloading;
+					fs::path file;
+					try {
+						file = fetchDeb(planned.url, planned.sha256, planned.size);
+					} catch (...) {
+						progress.end(progressEntry);
+						throw;
+					}
+					// still in flight until extracted
+					pipeline().cpu(Scheduler::Extract, [extractFile, file, lease] { extractFile(file, ""); });
 				});
 			}
 		}
 
+		void drawLiveView(vector<ProgressTracker::Snapshot> snapshot) {
+			static const char* phases[] = {"queued", "downloading", "extracting", "done"};
+			std::sort(snapshot.begin(), snapshot.end(), [](auto& a, auto& b) { return a.name < b.name; });
+			liveViewInstalling << estd::clearScreen << estd::moveCursor(0, 0);
+			for (auto& entry : snapshot) {
+				liveViewInstalling << estd::setTextColor(0, 255, 0) << entry.name << estd::clearSettings << " "
+								   << phases[entry.phase] << " " << entry.bytes / 1024 << "/" << entry.total / 1024
+								   << " KiB\n";
+			}
+		}
+
+		size_t decompressThreads() {
+			if (decompressionThreads != 0) return decompressionThreads;
+			return std::max<size_t>(1, std::thread::hardware_concurrency());
+		}
+
+		FileWriter& fileWriter() {
+			std::lock_guard<std::mutex> lock(manifestMtx);
+			if (!writer) {
+				writer = std::make_unique<FileWriter>(writerThreads);
+				writer->tracer = &tracer;
+			}
+			return *writer;
+		}
+
+		// Shared by every caller, each top level operation waits on its own Scheduler::Group.
+		Scheduler& pipeline() {
+			std::call_once(schedulerCreated, [this] {
+				scheduler = std::make_unique<Scheduler>(ioThreads, cpuThreads);
+				connectionPool.scheduler = scheduler.get();
+			});
+			return *scheduler;
+		}
+
 		void autoDetectArch() {
 			if (getBuildArchitecture() == "x86_64") {
 				architecture = "binary-amd64";
@@ -484,23 +1684,71 @@ namespace deb {
 	public:
 		std::string architecture = "binary-amd64";
 		estd::joint_ptr<estd::files::TmpDir> tmpDirectory;
+		// when set, Packages indexes are kept here between runs and only revalidated with conditional requests
+		std::filesystem::path indexCacheDirectory = "";
 		int recursionLimit = 9999;
 		bool throwOnFailedDependency = true;
 		bool throwOnFailedSourceURL = false;
 		// dont do this, there can be links among different packages like libX.so linking to libX.so.5.1.1 which can mess up linking with ld
 		bool extractHardLinksAsCopies = false;
 		bool extractSoftLinksAsCopies = false;
+		// keep a .deb-manifest in every destination, so installing again skips packages that haven't changed and
+		// doesn't rewrite files whose contents are the same (their mtimes survive, builds depending on them don't rerun)
+		bool incrementalInstall = true;
+		// fetch only packages that, according to the repository's Contents-<arch> index, have a file under one of the
+		// requested source paths. Contents indexes are tens of MB per distribution, this pays off for path-limited
+		// installs (headers and libs only) of big dependency closures
+		bool pruneWithContents = false;
+		// install(jobs) writes what it resolved here, install(Lockfile::load(lockFile)) later repeats exactly that install
+		std::filesystem::path lockFile = "";
+		// extract while the .deb is still downloading instead of going through a file in tmpDirectory
+		bool streamingInstall = true;
+		size_t streamBufferSize = 4 << 20;
+		// .debs of at least parallelDownloadThreshold bytes go to tmpDirectory over this many concurrent range requests
+		// instead of being streamed, one connection rarely saturates the link for the really big ones
+		size_t parallelDownloads = 4;
+		uint64_t parallelDownloadThreshold = 32 << 20;
+		// content addressed store of verified .debs shared by every install and run, keyed by the Packages SHA256
+		std::filesystem::path debCacheDirectory = "";
+		// .debs and whole indexes against the SHA256 their index or Release lists. pdiffs are checked regardless,
+		// the hashes are how the patches to apply are found
+		bool verifyChecksums = true;
+		// only Depends and Pre-Depends are mandatory, each alternative group pulls in a single member
+		bool followRecommends = true;
+		bool followSuggests = false;
+		// resolves every root a second time without the filters above to report what they saved, off by default
+		bool reportDependencySavings = false;
+		ResolutionReport lastResolution;
+		bool liveView = true;
+		std::chrono::milliseconds liveViewInterval{250};
+		// downloads wait on sockets and get many threads, decompression and extraction get one per core (0 = auto).
+		// Read when the pipeline is first used.
+		size_t ioThreads = 32;
+		size_t cpuThreads = 0;
+		// threads a single data.tar.xz/.zst may decode on, only multi-block/multi-frame archives use more than one (0 = auto)
+		size_t decompressionThreads = 0;
+		// threads writing extracted files out while the extract tasks keep decoding (0 = write on the extract task).
+		// Only the per file tracking extraction (incrementalInstall) uses them
+		size_t writerThreads = 4;
+		// when set, install() records spans per package and phase and writes them here as Chrome trace-event JSON
+		std::filesystem::path traceFile = "";
 
 		uint16_t minPermissions = 0777;
 
 		Installer() {
 			autoDetectArch();
 			autoInitSources();
+			connectionPool.tracer = &tracer;
+			connectionPool.mirrors = &mirrors;
+			connectionPool.budget = &budget;
 		}
 
 		Installer(estd::joint_ptr<estd::files::TmpDir> tmp = nullptr) {
 			autoDetectArch();
 			autoInitSources();
+			connectionPool.tracer = &tracer;
+			connectionPool.mirrors = &mirrors;
+			connectionPool.budget = &budget;
 			if (tmp) {
 				tmpDirectory = tmp;
 			} else {
@@ -518,30 +1766,32 @@ namespace deb {
 				boost::regex_replace(noCommentsList, rex2, "deb");// remove blocks with arch line so deb [arch=...]
 			auto list = estd::string_util::splitAll(noCommentsList, "\n", false);
 			addSources(list);
-			packageToUrl = {};
+			packageIndex.clear();
 		}
 
 		void addSources(vector<string> l) {
 			sourcesList.insert(sourcesList.end(), l.begin(), l.end());
-			packageToUrl = {};
+			packageIndex.clear();
 		}
 
 		void setSources(vector<string> l) {
 			sourcesList = l;
-			packageToUrl = {};
+			packageIndex.clear();
 		}
 
 		void markPreInstalled(std::set<std::string> pkgs) {
-			if (packageToUrl.empty()) getPackageList();
+			if (packageIndex.empty()) getPackageList();
 
 			for (auto pkg : pkgs) preInstalled.insert(pkg);
 			//TODO: mark dependencies as installed as well
 		}
 
 		void markInstalled(std::set<std::string> pkgs) {
-			if (packageToUrl.empty()) getPackageList();
+			if (packageIndex.empty()) getPackageList();
 
-			for (auto pkg : pkgs) installed.insert(pkg);
+			for (auto pkg : pkgs) {
+				if (packageIndex.count(pkg)) installed.insert(packageIndex.url(pkg));
+			}
 			//TODO: mark dependencies as installed as well
 		}
 
@@ -550,16 +1800,159 @@ namespace deb {
 		void install(string package, string location) { install(package, {{"./", location}}); }
 
 		void install(std::string package, std::set<std::pair<std::string, std::string>> locations) {
-			if (packageToUrl.empty()) getPackageList();
+			install(vector<InstallJob>{{package, locations}});
+		}
 
-			installed.insert(preInstalled.begin(), preInstalled.end());
+		// Resolves several targets into one lockfile, nothing is downloaded. Every job gets its own dependency closure,
+		// jobs are resolved against what was installed before the batch so shared dependencies show up in each.
+		Lockfile resolveLockfile(const vector<InstallJob>& jobs) {
+			if (packageIndex.empty()) getPackageList();
 
-			auto pkgs = split(package, "\\s+");
-			for (auto pkg : pkgs) {
-				trm.schedule([this, pkg, locations]() { installPrivate(pkg, locations, recursionLimit); });
+			for (auto pkg : preInstalled) {
+				if (packageIndex.count(pkg)) installed.insert(packageIndex.url(pkg));
+			}
+
+			lastResolution = {};
+			auto lockfile = resolveLockfile(jobs, installed, lastResolution);
+			for (auto& [key, package] : lockfile.packages) installed.insert(package.url);
+			return lockfile;
+		}
+
+		// resolveLockfile(jobs) against installedUrls, without recording anything in installed or lastResolution.
+		// Only reads the index, like resolve(installedUrls).
+		Lockfile resolveLockfile(
+			const vector<InstallJob>& jobs,
+			const std::set<string>& installedUrls,
+			ResolutionReport& resolution
+		) {
+			Lockfile lockfile;
+			for (auto& job : jobs) {
+				auto roots = split(job.packages, "\\s+");
+				auto resolveSpan = tracer.span("resolve", job.packages);
+				vector<string> alreadyInstalled;
+				auto plan = resolve(roots, recursionLimit, installedUrls, false, &alreadyInstalled);
+				resolveSpan.end();
+				for (auto& name : alreadyInstalled) cout << "already installed " + name + "\n";
+				cout << "resolved " << plan.size() << " packages for " << job.packages << "\n";
+				if (reportDependencySavings) {
+					auto report = reportResolution(roots, plan, installedUrls);
+					resolution.packages += report.packages;
+					resolution.bytes += report.bytes;
+					resolution.unfilteredPackages += report.unfilteredPackages;
+					resolution.unfilteredBytes += report.unfilteredBytes;
+				}
+
+				// dependencies were followed through them, but packages without a file under any source path aren't
+				// fetched for this job
+				std::set<string> contributing;
+				if (pruneWithContents && contributingPackages(plan, job.locations, contributing)) {
+					size_t before = plan.size();
+					plan.erase(
+						std::remove_if(
+							plan.begin(), plan.end(), [&](auto& planned) { return !contributing.count(planned.name); }
+						),
+						plan.end()
+					);
+					cout << "pruned " << before - plan.size() << " packages with no files under the requested paths\n";
+				}
+
+				for (auto& planned : plan)
+					lockfile.add({planned.name, planned.url, planned.sha256, planned.size, job.locations});
+			}
+			if (reportDependencySavings) {
+				cout << "selected " << resolution.packages << " packages (" << resolution.bytes
+					 << " bytes), every alternative + Recommends + Suggests would be " << resolution.unfilteredPackages
+					 << " packages (" << resolution.unfilteredBytes << " bytes)\n";
+			}
+			if (jobs.size() > 1)
+				cout << lockfile.packages.size() << " distinct packages across " << jobs.size() << " jobs\n";
+			return lockfile;
+		}
+
+		// Installs several targets in one pass. A package shared by several of them is still downloaded and decoded once
+		// and its data.tar is fanned out to all of their locations. Nothing waits between jobs, the whole batch runs under
+		// one pipeline barrier.
+		void install(const vector<InstallJob>& jobs) {
+			if (!traceFile.empty()) tracer.enabled = true;
+			auto lockfile = resolveLockfile(jobs);
+			if (!lockFile.empty()) lockfile.save(lockFile);
+			install(lockfile);
+		}
+
+		// Installs exactly the builds pinned in lockfile, without fetching an index or resolving anything.
+		void install(Lockfile lockfile) {
+			for (auto& [key, package] : lockfile.packages) installed.insert(package.url);
+			installPinned(std::move(lockfile));
+		}
+
+		// install(Lockfile) without recording the packages as installed for later resolutions. Reads neither the index
+		// nor the resolver's state, so lookups and resolutions can go on while it runs, and so can other installs.
+		// Installs running at the same time must not extract the same package into the same destination.
+		void installPinned(Lockfile lockfile) {
+			if (!traceFile.empty()) tracer.enabled = true;
+			auto planned = [](const LockedPackage& package) {
+				return PlannedPackage{package.name, package.url, package.sha256, package.size};
+			};
+
+			// destinations that already have a package in this exact build are left out of its extraction,
+			// a package no destination needs anymore isn't fetched at all
+			std::set<string> destinations;
+			std::shared_ptr<void> releaseManifests;
+			if (incrementalInstall) {
+				for (auto& [key, package] : lockfile.packages)
+					for (auto& location : package.locations) destinations.insert(location.second);
+				std::lock_guard<std::mutex> lock(manifestMtx);
+				// read from disk again unless another running install has the destination open
+				for (auto& destination : destinations)
+					if (manifestUsers[destination]++ == 0) manifests[destination] = InstallManifest(destination);
+				releaseManifests = std::shared_ptr<void>(nullptr, [this, destinations](void*) {
+					std::lock_guard<std::mutex> lock(manifestMtx);
+					for (auto& destination : destinations) {
+						if (--manifestUsers[destination] > 0) continue;
+						manifestUsers.erase(destination);
+						manifests.erase(destination);
+					}
+				});
+
+				size_t unchanged = 0;
+				for (auto& [key, package] : lockfile.packages) {
+					auto& locations = package.locations;
+					for (auto it = locations.begin(); it != locations.end();) {
+						if (manifests[it->second].upToDate(package.name, packageId(planned(package))))
+							it = locations.erase(it);
+						else
+							++it;
+					}
+					if (locations.empty()) unchanged++;
+				}
+				cout << unchanged << " packages unchanged since the last install\n";
+			}
+
+			// another install sharing the pipeline neither waits for these tasks nor sees their errors
+			Scheduler::Group group;
+			auto scope = pipeline().enter(group);
+			// the live view is redrawn from snapshots by its own thread, workers only touch their atomics
+			std::unique_ptr<ProgressRenderer> renderer;
+			if (liveView) {
+				renderer = std::make_unique<ProgressRenderer>(
+					progress, [this](auto& snapshot) { drawLiveView(snapshot); }, liveViewInterval
+				);
+			}
+			for (auto& [key, package] : lockfile.packages) {
+				if (!package.locations.empty()) installPrivate(planned(package), package.locations);
+			}
+			// a failed install leaves the manifests on disk as they were, the next one checks every package again
+			pipeline().wait();
+			if (incrementalInstall) saveManifests(destinations);
+			cout << pipeline().statsReport();
+			cout << "http: " << connectionPool.connections() << " connections for " << connectionPool.requests()
+				 << " requests, reuse ratio " << connectionPool.reuseRatio() << "\n";
+			if (!mirrors.allGroups().empty()) cout << mirrors.report();
+			if (budget.limited()) cout << budget.report();
+			if (!traceFile.empty()) {
+				tracer.writeChromeTrace(traceFile.string());
+				cout << tracer.summary();
 			}
-			trm.forwardExceptions = true;
-			trm.wait();
 		}
 	};
 };// namespace deb
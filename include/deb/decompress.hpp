@@ -0,0 +1,297 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <istream>
+#include <lzma.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zstd.h>
+
+#include <bxzstr.hpp>
+
+#include <deb/scheduler.hpp>
+
+namespace deb {
+	// Recycles the large buffers the decoders work with, so every package doesn't reallocate (and fault in) megabytes.
+	class BufferPool {
+	public:
+		using Buffer = std::unique_ptr<std::vector<char>, std::function<void(std::vector<char>*)>>;
+
+		static BufferPool& shared() {
+			static BufferPool pool;
+			return pool;
+		}
+
+		Buffer acquire(size_t size) {
+			std::vector<char>* buffer = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (!free.empty()) {
+					buffer = free.back().release();
+					free.pop_back();
+					pooledBytes -= buffer->capacity();
+				}
+			}
+			if (!buffer) buffer = new std::vector<char>();
+			buffer->resize(size);
+			return Buffer(buffer, [this](std::vector<char>* b) { release(b); });
+		}
+
+		// what the free list may hold, by count and by capacity. A buffer that would go over either is freed, so a
+		// burst of large frames doesn't stay resident after it
+		size_t maxPooled = 64;
+		size_t maxPooledBytes = 128 << 20;
+
+	private:
+		std::mutex mtx;
+		std::vector<std::unique_ptr<std::vector<char>>> free;
+		size_t pooledBytes = 0;
+
+		void release(std::vector<char>* buffer) {
+			std::unique_ptr<std::vector<char>> owned(buffer);
+			std::lock_guard<std::mutex> lock(mtx);
+			size_t bytes = owned->capacity();
+			if (free.size() >= maxPooled || pooledBytes + bytes > maxPooledBytes) return;
+			pooledBytes += bytes;
+			free.push_back(std::move(owned));
+		}
+	};
+
+	// xz decoder that hands independent blocks to liblzma's worker threads. Streams written as a single block
+	// (plain `xz` without -T) have nothing to split and liblzma decodes them on the calling thread.
+	class XzStreambuf : public std::streambuf {
+	public:
+		XzStreambuf(std::istream& in, size_t threads, size_t bufferSize = 1 << 20) :
+			in(in), input(BufferPool::shared().acquire(bufferSize)), output(BufferPool::shared().acquire(bufferSize)) {
+			lzma_ret ret;
+#if LZMA_VERSION >= 50040002
+			lzma_mt mt;
+			std::memset(&mt, 0, sizeof(mt));
+			mt.flags = LZMA_CONCATENATED;
+			mt.threads = std::max<uint32_t>(1, threads);
+			mt.memlimit_threading = std::max<uint64_t>(lzma_physmem() / 4, 128 << 20);
+			mt.memlimit_stop = UINT64_MAX;
+			ret = lzma_stream_decoder_mt(&strm, &mt);
+#else
+			ret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+			if (ret != LZMA_OK) throw std::runtime_error("could not initialize the xz decoder");
+		}
+		XzStreambuf(const XzStreambuf&) = delete;
+		~XzStreambuf() { lzma_end(&strm); }
+
+	protected:
+		int_type underflow() override {
+			if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+			while (!ended) {
+				if (strm.avail_in == 0 && !inputEnded) {
+					in.read(input->data(), input->size());
+					strm.next_in = (const uint8_t*)input->data();
+					strm.avail_in = in.gcount();
+					if (strm.avail_in == 0) inputEnded = true;
+				}
+				strm.next_out = (uint8_t*)output->data();
+				strm.avail_out = output->size();
+				lzma_ret ret = lzma_code(&strm, inputEnded ? LZMA_FINISH : LZMA_RUN);
+				if (ret == LZMA_STREAM_END) ended = true;
+				else if (ret != LZMA_OK) throw std::runtime_error("xz decoding failed (" + std::to_string(ret) + ")");
+				size_t produced = output->size() - strm.avail_out;
+				if (produced > 0) {
+					setg(output->data(), output->data(), output->data() + produced);
+					return traits_type::to_int_type(*gptr());
+				}
+			}
+			return traits_type::eof();
+		}
+
+	private:
+		std::istream& in;
+		BufferPool::Buffer input;
+		BufferPool::Buffer output;
+		lzma_stream strm = LZMA_STREAM_INIT;
+		bool inputEnded = false;
+		bool ended = false;
+	};
+
+	// zstd decoder that decodes up to `threads` complete frames concurrently and returns them in order.
+	// Multi-frame archives come from pzstd and friends; a frame that doesn't fit in the look-ahead window
+	// (regular single-frame `zstd` output) is streamed through one context instead.
+	// Frames of every stream decode on framePool(), so many packages extracting at once don't start a thread per frame.
+	class ZstdStreambuf : public std::streambuf {
+	public:
+		ZstdStreambuf(std::istream& in, size_t threads, size_t windowSize = 8 << 20) :
+			in(in), threads(std::max<size_t>(threads, 1)), window(BufferPool::shared().acquire(windowSize)),
+			output(BufferPool::shared().acquire(ZSTD_DStreamOutSize())), dctx(ZSTD_createDCtx()) {
+			if (!dctx) throw std::runtime_error("could not initialize the zstd decoder");
+		}
+		ZstdStreambuf(const ZstdStreambuf&) = delete;
+		~ZstdStreambuf() { ZSTD_freeDCtx(dctx); }
+
+		// One thread per core shared by all streams. Not the scheduler's cpu pool: the extract tasks running there
+		// wait for these frames, queued behind them the frames would never run.
+		static WorkStealingPool& framePool() {
+			static WorkStealingPool pool(std::max<size_t>(1, std::thread::hardware_concurrency()));
+			return pool;
+		}
+
+	protected:
+		int_type underflow() override {
+			if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+			for (;;) {
+				if (!streaming) dispatchFrames();
+				if (!pending.empty()) {
+					current = pending.front().get();
+					pending.pop_front();
+					if (current->empty()) continue;
+					setg(current->data(), current->data(), current->data() + current->size());
+					return traits_type::to_int_type(*gptr());
+				}
+				if (begin == end && !fill()) {
+					if (streaming) throw std::runtime_error("zstd stream is truncated");
+					return traits_type::eof();
+				}
+				streaming = true;
+				size_t produced = streamStep();
+				if (produced > 0) {
+					setg(output->data(), output->data(), output->data() + produced);
+					return traits_type::to_int_type(*gptr());
+				}
+			}
+		}
+
+	private:
+		std::istream& in;
+		size_t threads;
+		BufferPool::Buffer window;
+		size_t begin = 0, end = 0;
+		bool inputEnded = false;
+		BufferPool::Buffer output;
+		BufferPool::Buffer current;
+		ZSTD_DCtx* dctx;
+		bool streaming = false;
+		std::deque<std::future<BufferPool::Buffer>> pending;
+		// largest decoded size a frame header is trusted with, bigger frames stream through dctx in bounded memory
+		static constexpr unsigned long long maxFrameContent = 64 << 20;
+
+		// Moves the unread bytes to the front of the window and tops it up, returns false if nothing could be added.
+		bool fill() {
+			if (inputEnded) return false;
+			if (begin > 0) {
+				std::memmove(window->data(), window->data() + begin, end - begin);
+				end -= begin;
+				begin = 0;
+			}
+			if (end == window->size()) return false;
+			in.read(window->data() + end, window->size() - end);
+			end += in.gcount();
+			if (in.gcount() == 0) inputEnded = true;
+			return in.gcount() > 0;
+		}
+
+		// Queues every complete frame in the window until `threads` are in flight. Stops at a frame too big for
+		// the window, or one whose header doesn't promise a sane decoded size; it is then streamed once the frames
+		// before it have been handed out.
+		void dispatchFrames() {
+			while (pending.size() < threads) {
+				size_t frameSize = ZSTD_findFrameCompressedSize(window->data() + begin, end - begin);
+				if (ZSTD_isError(frameSize)) {
+					if (fill()) continue;
+					return;
+				}
+				auto contentSize = ZSTD_getFrameContentSize(window->data() + begin, frameSize);
+				if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN || contentSize == ZSTD_CONTENTSIZE_ERROR) return;
+				if (contentSize > maxFrameContent) return;
+				auto frame = BufferPool::shared().acquire(frameSize);
+				std::memcpy(frame->data(), window->data() + begin, frameSize);
+				begin += frameSize;
+				// shared, the pool only takes copyable tasks
+				auto decode = std::make_shared<std::packaged_task<BufferPool::Buffer()>>(
+					[frame = std::shared_ptr<std::vector<char>>(std::move(frame))] { return decodeFrame(*frame); }
+				);
+				pending.emplace_back(decode->get_future());
+				framePool().submit([decode] { (*decode)(); });
+			}
+		}
+
+		size_t streamStep() {
+			ZSTD_inBuffer inBuf{window->data() + begin, end - begin, 0};
+			ZSTD_outBuffer outBuf{output->data(), output->size(), 0};
+			size_t ret = ZSTD_decompressStream(dctx, &outBuf, &inBuf);
+			if (ZSTD_isError(ret))
+				throw std::runtime_error(std::string("zstd decoding failed: ") + ZSTD_getErrorName(ret));
+			begin += inBuf.pos;
+			// the frame is done, look for independent frames again
+			if (ret == 0) streaming = false;
+			return outBuf.pos;
+		}
+
+		// Only called for frames whose header size passed the cap in dispatchFrames.
+		static BufferPool::Buffer decodeFrame(const std::vector<char>& frame) {
+			auto decoded = BufferPool::shared().acquire(ZSTD_getFrameContentSize(frame.data(), frame.size()));
+			std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+			size_t ret = ZSTD_decompressDCtx(ctx.get(), decoded->data(), decoded->size(), frame.data(), frame.size());
+			if (ZSTD_isError(ret))
+				throw std::runtime_error(std::string("zstd decoding failed: ") + ZSTD_getErrorName(ret));
+			decoded->resize(ret);
+			return decoded;
+		}
+	};
+
+	// istream over the right decoder for a compressed member, picked by its extension.
+	// xz and zst go through the parallel decoders, everything else (gz, bz2, uncompressed) through bxz.
+	class DecompressStream : public std::istream {
+	public:
+		DecompressStream(std::istream& in, const std::string& name, size_t threads) : std::istream(nullptr) {
+			auto endsWith = [&](const std::string& suffix) {
+				return name.size() >= suffix.size() &&
+					   name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+			};
+			if (endsWith(".xz")) buffer = std::make_unique<XzStreambuf>(in, threads);
+			else if (endsWith(".zst"))
+				buffer = std::make_unique<ZstdStreambuf>(in, threads);
+			else
+				fallback = std::make_unique<bxz::istream>(in);
+			rdbuf(buffer ? buffer.get() : fallback->rdbuf());
+		}
+
+	private:
+		std::unique_ptr<std::streambuf> buffer;
+		std::unique_ptr<bxz::istream> fallback;
+	};
+};// namespace deb
@@ -0,0 +1,163 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace deb {
+	enum class Relation : uint8_t { None, Less, LessEqual, Equal, GreaterEqual, Greater };
+
+	inline const char* relationString(Relation relation) {
+		static const char* names[] = {"", "<<", "<=", "=", ">=", ">>"};
+		return names[int(relation)];
+	}
+
+	// One entry of a Depends-style field as views into the field, "name:arch (relation version)".
+	struct DependencyTerm {
+		std::string_view name;
+		std::string_view arch;
+		Relation relation = Relation::None;
+		std::string_view version;
+		bool endsGroup = false;// the last alternative of its '|' group
+	};
+
+	// Single pass over a Depends / Pre-Depends / Recommends / Suggests value, calls f(const DependencyTerm&) for every
+	// alternative in order without allocating. Architecture lists "[amd64]" and build profiles "<!nocheck>" are skipped.
+	template <typename F>
+	void forEachDependency(std::string_view field, F f) {
+		size_t i = 0;
+		auto isBlank = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+		auto isOneOf = [](char c, std::string_view set) { return set.find(c) != std::string_view::npos; };
+		auto skipBlank = [&] {
+			while (i < field.size() && isBlank(field[i])) i++;
+		};
+		auto skipUntil = [&](char c) {
+			while (i < field.size() && field[i] != c) i++;
+			if (i < field.size()) i++;
+		};
+
+		// held back one step, whether it ends its group is only known once the separator after it is seen
+		DependencyTerm pending;
+		bool hasPending = false;
+		while (i <= field.size()) {
+			skipBlank();
+			DependencyTerm term;
+			size_t start = i;
+			while (i < field.size() && !isBlank(field[i]) && !isOneOf(field[i], ":(,|[<")) i++;
+			term.name = field.substr(start, i - start);
+
+			while (true) {
+				skipBlank();
+				if (i >= field.size()) break;
+				char c = field[i];
+				if (c == ':') {
+					i++;
+					start = i;
+					while (i < field.size() && !isBlank(field[i]) && !isOneOf(field[i], "(,|[<")) i++;
+					term.arch = field.substr(start, i - start);
+				} else if (c == '(') {
+					i++;
+					skipBlank();
+					start = i;
+					while (i < field.size() && isOneOf(field[i], "<=>")) i++;
+					auto relation = field.substr(start, i - start);
+					// "<" and ">" are deprecated spellings of "<=" and ">="
+					if (relation == "<<") term.relation = Relation::Less;
+					else if (relation == "<=" || relation == "<")
+						term.relation = Relation::LessEqual;
+					else if (relation == "=")
+						term.relation = Relation::Equal;
+					else if (relation == ">=" || relation == ">")
+						term.relation = Relation::GreaterEqual;
+					else if (relation == ">>")
+						term.relation = Relation::Greater;
+					skipBlank();
+					start = i;
+					while (i < field.size() && field[i] != ')' && !isBlank(field[i])) i++;
+					term.version = field.substr(start, i - start);
+					skipUntil(')');
+				} else if (c == '[') {
+					skipUntil(']');
+				} else if (c == '<') {
+					skipUntil('>');
+				} else {
+					break;
+				}
+			}
+
+			if (!term.name.empty()) {
+				if (hasPending) f(pending);
+				pending = term;
+				hasPending = true;
+			}
+			if (i < field.size() && field[i] == '|') {
+				i++;
+				continue;
+			}
+			if (hasPending) {
+				pending.endsGroup = true;
+				f(pending);
+				hasPending = false;
+			}
+			if (i >= field.size()) break;
+			if (field[i] == ',') i++;
+			else
+				skipUntil(',');// garbage, resync at the next group
+		}
+	}
+
+	// One entry of a Depends-style field, "name:arch (relation version)".
+	struct Dependency {
+		std::string name;
+		std::string arch = "";
+		std::string relation = "";// one of << <= = >= >>, empty when unversioned
+		std::string version = "";
+	};
+
+	// Alternatives separated by '|', any one of them satisfies the group.
+	using DependencyGroup = std::vector<Dependency>;
+
+	// forEachDependency collected into owned strings, alternative groups kept intact.
+	inline std::vector<DependencyGroup> parseDependencies(std::string_view field) {
+		std::vector<DependencyGroup> result;
+		DependencyGroup group;
+		forEachDependency(field, [&](const DependencyTerm& term) {
+			group.push_back(
+				{std::string(term.name), std::string(term.arch), relationString(term.relation), std::string(term.version)}
+			);
+			if (term.endsGroup) result.push_back(std::move(group)), group = {};
+		});
+		return result;
+	}
+};// namespace deb
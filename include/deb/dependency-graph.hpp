@@ -0,0 +1,122 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <cstdint>
+#include <deb/dependencies.hpp>
+#include <deb/package-index.hpp>
+#include <string_view>
+#include <vector>
+
+namespace deb {
+	// The Depends-style fields of a PackageIndex with every alternative resolved to a package id.
+	// A package is compiled the first time it is asked for and kept, names and versions are views into the index's
+	// strings, so the graph is only valid as long as the index isn't changed (see matches()).
+	class DependencyGraph {
+	public:
+		static constexpr uint32_t unknown = UINT32_MAX;// a name no package in the index provides
+		enum Field { PreDepends, Depends, Recommends, Suggests, FieldCount };
+
+		struct Alternative {
+			uint32_t package = unknown;
+			Relation relation = Relation::None;
+			std::string_view name;
+			std::string_view arch;
+			std::string_view version;
+		};
+
+		DependencyGraph(const PackageIndex& index) :
+			index(index), packages(index.packagesSize()), strings(index.str({0, 0}).data()),
+			spans(packages * FieldCount), compiled(packages, false) {}
+
+		// still describes index, false once it was rebuilt or reloaded
+		bool matches(const PackageIndex& other) const {
+			return &other == &index && other.packagesSize() == packages && other.str({0, 0}).data() == strings;
+		}
+
+		// Calls f(const Alternative* begin, const Alternative* end) for every '|' group of field of package.
+		// f must not ask the graph for other packages, compiling one may move the alternatives.
+		template <typename F>
+		void forEachGroup(uint32_t package, Field field, F f) {
+			compile(package);
+			auto& span = spans[package * FieldCount + field];
+			for (uint32_t g = span.firstGroup; g < span.firstGroup + span.groups; g++) {
+				uint32_t begin = g == 0 ? 0 : groupEnds[g - 1];
+				f(alternatives.data() + begin, alternatives.data() + groupEnds[g]);
+			}
+		}
+
+		// Compiles every package up front, after that forEachGroup() only reads and may be called from many threads.
+		void compileAll() {
+			for (uint32_t package = 0; package < packages; package++) compile(package);
+		}
+
+		size_t compiledPackages() const { return compiledCount; }
+		size_t memoryUsage() const {
+			return alternatives.capacity() * sizeof(Alternative) + groupEnds.capacity() * sizeof(uint32_t) +
+				   spans.capacity() * sizeof(Span) + compiled.capacity() / 8;
+		}
+
+	private:
+		struct Span {
+			uint32_t firstGroup = 0;
+			uint32_t groups = 0;
+		};
+
+		const PackageIndex& index;
+		size_t packages;
+		const char* strings;
+		std::vector<Alternative> alternatives;
+		std::vector<uint32_t> groupEnds;// one past the last alternative of every group
+		std::vector<Span> spans;// FieldCount per package
+		std::vector<bool> compiled;
+		size_t compiledCount = 0;
+
+		void compile(uint32_t package) {
+			if (compiled[package]) return;
+			compiled[package] = true;
+			compiledCount++;
+			auto& pkg = index.package(package);
+			PackageIndex::StringRef fields[FieldCount] = {pkg.preDepends, pkg.depends, pkg.recommends, pkg.suggests};
+			for (int field = 0; field < FieldCount; field++) {
+				auto& span = spans[package * FieldCount + field];
+				span.firstGroup = uint32_t(groupEnds.size());
+				forEachDependency(index.str(fields[field]), [&](const DependencyTerm& term) {
+					auto* target = index.find(term.name);
+					alternatives.push_back(
+						{target ? index.id(*target) : unknown, term.relation, term.name, term.arch, term.version}
+					);
+					if (term.endsGroup) groupEnds.push_back(uint32_t(alternatives.size()));
+				});
+				span.groups = uint32_t(groupEnds.size()) - span.firstGroup;
+			}
+		}
+	};
+};// namespace deb
@@ -0,0 +1,360 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#ifdef DEB_USE_IO_URING
+#include <liburing.h>
+#endif
+
+#include <deb/tracing.hpp>
+
+namespace deb {
+	// Write-out stage of extraction. The decoding thread hands every finished file to a pool of writer threads and
+	// goes on decoding, each worker takes its queue in batches (one io_uring submission per batch on a ring of the
+	// worker's own when built with DEB_USE_IO_URING and liburing). Whatever depends on other entries being on disk,
+	// hard links, symlinks and permissions, is queued on the Batch and applied by finish() once the files are written.
+	class FileWriter {
+		struct State;
+
+	public:
+		// The files of one package. Not thread safe, it belongs to the thread decoding that package.
+		class Batch {
+		public:
+			Batch(FileWriter& writer) : writer(writer), state(std::make_shared<State>()) {}
+			Batch(const Batch&) = delete;
+			~Batch() {
+				try {
+					wait();
+				} catch (...) {}
+			}
+
+			// create_directories, once per directory and batch
+			void directories(const std::filesystem::path& path) {
+				if (created.insert(path.string()).second) std::filesystem::create_directories(path);
+			}
+
+			// Replaces path with content. With keepIfSameSize a regular file of that size is taken to be up to date
+			// (the caller knows the previous version had the same hash) and left alone.
+			void write(const std::filesystem::path& path, std::string content, bool keepIfSameSize = false) {
+				directories(path.parent_path());
+				writer.submit({state, path, std::move(content), keepIfSameSize});
+			}
+
+			// runs in finish(), in the order queued, after every write of the batch
+			void later(std::function<void()> fixup) { fixups.push_back(std::move(fixup)); }
+
+			// Waits for the writes, rethrows the first error, then applies the fixups.
+			void finish() {
+				wait();
+				auto pending = std::move(fixups);
+				fixups.clear();
+				for (auto& fixup : pending) fixup();
+			}
+
+		private:
+			FileWriter& writer;
+			std::shared_ptr<State> state;
+			std::set<std::string> created;
+			std::vector<std::function<void()>> fixups;
+
+			void wait() {
+				std::unique_lock<std::mutex> lock(writer.mtx);
+				writer.idle.wait(lock, [&] { return state->pending == 0; });
+				if (state->error) std::rethrow_exception(std::exchange(state->error, nullptr));
+			}
+		};
+
+		// queued contents above this block the decoding threads until the workers catch up
+		size_t maxQueuedBytes = 64 << 20;
+		// files written per io_uring submission (or per wake up of a worker without it)
+		size_t batchSize = 64;
+		Tracer* tracer = nullptr;
+
+		// threads = 0 writes on the submitting thread, like extracting without a write-out stage
+		FileWriter(size_t threads) : queues(threads) {
+			for (size_t i = 0; i < threads; i++) workers.emplace_back([this, i] { run(i); });
+		}
+		FileWriter(const FileWriter&) = delete;
+		~FileWriter() {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				stopping = true;
+			}
+			work.notify_all();
+			for (auto& worker : workers) worker.join();
+		}
+
+		size_t threads() const { return workers.size(); }
+
+	private:
+		struct State {
+			size_t pending = 0;
+			std::exception_ptr error;
+			std::atomic_bool failed{false};// error is set, readable without the lock
+		};
+		struct Job {
+			std::shared_ptr<State> state;
+			std::filesystem::path path;
+			std::string content;
+			bool keepIfSameSize = false;
+		};
+
+#ifdef DEB_USE_IO_URING
+		// Set up once per worker thread. Without one (the kernel refused it) the worker writes with pwrite.
+		struct Ring {
+			struct io_uring ring;
+			unsigned entries;
+			bool ready = false;
+
+			Ring(size_t entries) : entries(unsigned(std::max<size_t>(entries, 1))) {
+				ready = io_uring_queue_init(this->entries, &ring, 0) == 0;
+			}
+			Ring(const Ring&) = delete;
+			~Ring() {
+				if (ready) io_uring_queue_exit(&ring);
+			}
+
+			void reset() {
+				if (ready) io_uring_queue_exit(&ring);
+				ready = io_uring_queue_init(entries, &ring, 0) == 0;
+			}
+		};
+#else
+		struct Ring {
+			Ring(size_t) {}
+		};
+#endif
+
+		std::mutex mtx;
+		std::condition_variable work, idle, space;
+		std::vector<std::deque<Job>> queues;
+		std::vector<std::thread> workers;
+		size_t queuedBytes = 0;
+		bool stopping = false;
+
+		void submit(Job job) {
+			if (workers.empty()) {
+				// the error goes through the batch like it would from a worker
+				job.state->pending++;
+				complete(nullptr, {&job, 1});
+				return;
+			}
+			std::unique_lock<std::mutex> lock(mtx);
+			space.wait(lock, [&] { return queuedBytes == 0 || queuedBytes + job.content.size() <= maxQueuedBytes; });
+			queuedBytes += job.content.size();
+			job.state->pending++;
+			// the same path always lands on the same worker, a path written twice keeps the later contents
+			auto& queue = queues[std::hash<std::string>()(job.path.string()) % queues.size()];
+			queue.push_back(std::move(job));
+			work.notify_all();
+		}
+
+		void run(size_t index) {
+			auto& queue = queues[index];
+			std::vector<Job> batch;
+			Ring ring(batchSize);
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> lock(mtx);
+					work.wait(lock, [&] { return stopping || !queue.empty(); });
+					if (queue.empty()) return;
+					while (!queue.empty() && batch.size() < batchSize) {
+						queuedBytes -= queue.front().content.size();
+						batch.push_back(std::move(queue.front()));
+						queue.pop_front();
+					}
+				}
+				space.notify_all();
+				complete(&ring, {batch.data(), batch.size()});
+				batch.clear();
+			}
+		}
+
+		struct Jobs {
+			Job* data;
+			size_t size;
+		};
+
+		// Writes jobs and settles their batches, errors are kept per batch. ring is the worker's, if any.
+		void complete(Ring* ring, Jobs jobs) {
+			std::vector<int> fds(jobs.size, -1);
+			std::vector<std::exception_ptr> errors(jobs.size);
+			for (size_t i = 0; i < jobs.size; i++) {
+				try {
+					fds[i] = open(jobs.data[i]);
+				} catch (...) { errors[i] = std::current_exception(); }
+			}
+			writeAll(ring, jobs, fds, errors);
+			for (size_t i = 0; i < jobs.size; i++) {
+				if (fds[i] >= 0 && ::close(fds[i]) != 0 && !errors[i]) {
+					auto error = std::runtime_error("could not write " + jobs.data[i].path.string());
+					errors[i] = std::make_exception_ptr(error);
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mtx);
+			for (size_t i = 0; i < jobs.size; i++) {
+				auto& state = *jobs.data[i].state;
+				if (errors[i] && !state.error) state.error = errors[i], state.failed = true;
+				state.pending--;
+			}
+			idle.notify_all();
+		}
+
+		// The descriptor to write the job's contents to, -1 when the file is up to date.
+		// An existing file is replaced rather than written through, it may be a symlink or share its inode with a
+		// hard link.
+		int open(const Job& job) {
+			if (job.state->failed) return -1;// the package failed already, don't bother
+			struct stat st;
+			const char* path = job.path.c_str();
+			if (::lstat(path, &st) == 0) {
+				if (job.keepIfSameSize && S_ISREG(st.st_mode) && uint64_t(st.st_size) == job.content.size()) {
+					if (tracer) tracer->count(Tracer::FilesUnchanged, 1);
+					return -1;
+				}
+				::remove(path);
+			}
+			int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0) throw std::runtime_error("could not create " + job.path.string());
+			if (tracer) tracer->count(Tracer::FilesWritten, 1);
+			return fd;
+		}
+
+		static void writeFully(int fd, const std::string& content, size_t offset, const std::filesystem::path& path) {
+			while (offset < content.size()) {
+				ssize_t n = ::pwrite(fd, content.data() + offset, content.size() - offset, off_t(offset));
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) throw std::runtime_error("could not write " + path.string());
+				offset += size_t(n);
+			}
+		}
+
+#ifdef DEB_USE_IO_URING
+		// One submission for every write of the batch (more when the batch outgrows the ring), short writes are
+		// finished synchronously. Should the ring fail, every write not reaped from it is done again with pwrite,
+		// the same bytes to the same offsets, and the ring is set up anew for the next batch.
+		void writeAll(Ring* ring, Jobs jobs, std::vector<int>& fds, std::vector<std::exception_ptr>& errors) {
+			if (!ring || !ring->ready) {
+				writeEach(jobs, fds, errors);
+				return;
+			}
+			std::vector<bool> done(jobs.size, false);
+			size_t inFlight = 0;
+			bool broken = false;
+			auto reap = [&] {
+				if (io_uring_submit(&ring->ring) < 0) {
+					broken = true;
+					return;
+				}
+				while (inFlight > 0) {
+					struct io_uring_cqe* cqe;
+					int ret = io_uring_wait_cqe(&ring->ring, &cqe);
+					if (ret == -EINTR) continue;
+					if (ret != 0) {
+						broken = true;
+						return;
+					}
+					size_t i = size_t(io_uring_cqe_get_data(cqe));
+					int written = cqe->res;
+					io_uring_cqe_seen(&ring->ring, cqe);
+					inFlight--;
+					done[i] = true;
+					try {
+						if (written < 0) throw std::runtime_error("could not write " + jobs.data[i].path.string());
+						writeFully(fds[i], jobs.data[i].content, size_t(written), jobs.data[i].path);
+					} catch (...) { errors[i] = std::current_exception(); }
+				}
+			};
+
+			for (size_t i = 0; i < jobs.size && !broken; i++) {
+				if (fds[i] < 0 || jobs.data[i].content.empty()) {
+					done[i] = true;
+					continue;
+				}
+				auto* sqe = io_uring_get_sqe(&ring->ring);
+				if (!sqe) {
+					reap();
+					if (broken) break;
+					sqe = io_uring_get_sqe(&ring->ring);
+				}
+				auto& content = jobs.data[i].content;
+				io_uring_prep_write(sqe, fds[i], content.data(), unsigned(content.size()), 0);
+				io_uring_sqe_set_data(sqe, (void*)i);
+				inFlight++;
+			}
+			if (!broken) reap();
+			if (!broken) return;
+
+			ring->reset();
+			for (size_t i = 0; i < jobs.size; i++) {
+				if (done[i]) continue;
+				try {
+					writeFully(fds[i], jobs.data[i].content, 0, jobs.data[i].path);
+				} catch (...) { errors[i] = std::current_exception(); }
+			}
+		}
+#else
+		void writeAll(Ring*, Jobs jobs, std::vector<int>& fds, std::vector<std::exception_ptr>& errors) {
+			writeEach(jobs, fds, errors);
+		}
+#endif
+
+		void writeEach(Jobs jobs, std::vector<int>& fds, std::vector<std::exception_ptr>& errors) {
+			for (size_t i = 0; i < jobs.size; i++) {
+				if (fds[i] < 0) continue;
+				try {
+					writeFully(fds[i], jobs.data[i].content, 0, jobs.data[i].path);
+				} catch (...) { errors[i] = std::current_exception(); }
+			}
+		}
+	};
+};// namespace deb
@@ -0,0 +1,170 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace deb {
+	// Result of fetching one index, either a fresh body or a still valid cached file.
+	struct FetchedIndex {
+		std::string body = "";
+		std::filesystem::path cachedFile = "";
+		std::string validator = "";// empty when the index can't be revalidated later
+		std::string url = "";// what was fetched, its extension picks the decoder
+		bool ok = false;
+	};
+
+	// Persistent on-disk store for repository indexes (Packages.gz and friends).
+	// Each entry is a small metadata file holding the validators the server sent with it (ETag / Last-Modified)
+	// and naming the body file they belong to, so later runs can revalidate with a conditional GET instead of a full
+	// download.
+	class IndexCache {
+	public:
+		struct Entry {
+			std::string etag = "";
+			std::string lastModified = "";
+			std::string sha256 = "";// of the stored body, kept for files pdiffs get applied to
+			std::filesystem::path file;
+		};
+
+		IndexCache(std::filesystem::path directory) : directory(directory) {}
+
+		std::filesystem::path path() { return directory; }
+
+		bool lookup(const std::string& url, Entry& entry) {
+			std::lock_guard<std::mutex> lock(mtx);
+			return lookupLocked(url, entry);
+		}
+
+		static std::string validator(const std::string& etag, const std::string& lastModified) {
+			if (etag.empty() && lastModified.empty()) return "";
+			return etag + "|" + lastModified;
+		}
+
+		std::string read(const Entry& entry) {
+			std::ifstream file(entry.file, std::ios::binary);
+			std::stringstream ss;
+			ss << file.rdbuf();
+			return ss.str();
+		}
+
+		std::filesystem::path store(
+			const std::string& url,
+			const std::string& body,
+			std::string etag,
+			std::string lastModified,
+			std::string sha256 = ""
+		) {
+			std::lock_guard<std::mutex> lock(mtx);
+			std::filesystem::create_directories(directory);
+			auto base = directory / keyFor(url);
+			Entry previous;
+			bool replacing = lookupLocked(url, previous);
+
+			// Every body gets a file of its own, the meta file naming it is renamed into place last. An interrupted
+			// run leaves either the old meta with the old body or the new meta with the new one, at worst an orphan.
+			auto bodyFile = base.string() + "." + generation();
+			auto tmpMeta = metaPath(base).string() + ".part";
+			{
+				std::ofstream file(bodyFile, std::ios::binary | std::ios::trunc);
+				file.write(body.data(), body.size());
+				if (!file) throw std::runtime_error("Failed to write index cache file " + bodyFile);
+			}
+			{
+				std::ofstream meta(tmpMeta, std::ios::trunc);
+				meta << "Url: " << url << "\n";
+				meta << "Body: " << std::filesystem::path(bodyFile).filename().string() << "\n";
+				if (!etag.empty()) meta << "ETag: " << etag << "\n";
+				if (!lastModified.empty()) meta << "Last-Modified: " << lastModified << "\n";
+				if (!sha256.empty()) meta << "SHA256: " << sha256 << "\n";
+				if (!meta) throw std::runtime_error("Failed to write index cache file " + tmpMeta);
+			}
+			std::filesystem::rename(tmpMeta, metaPath(base));
+			std::error_code ec;
+			if (replacing) std::filesystem::remove(previous.file, ec);
+			return bodyFile;
+		}
+
+	private:
+		std::filesystem::path directory;
+		std::mutex mtx;
+
+		static std::filesystem::path metaPath(const std::filesystem::path& base) { return base.string() + ".meta"; }
+
+		// unique across runs and across the stores of this one
+		static std::string generation() {
+			static std::atomic_uint64_t counter{0};
+			auto now = std::chrono::system_clock::now().time_since_epoch().count();
+			return std::to_string(now) + "-" + std::to_string(counter++);
+		}
+
+		bool lookupLocked(const std::string& url, Entry& entry) {
+			auto base = directory / keyFor(url);
+			if (!std::filesystem::is_regular_file(metaPath(base))) return false;
+
+			std::ifstream meta(metaPath(base));
+			std::string line;
+			entry = Entry{};
+			// entries written before bodies had their own files kept the body at base
+			entry.file = base;
+			while (std::getline(meta, line)) {
+				auto pos = line.find(": ");
+				if (pos == std::string::npos) continue;
+				auto key = line.substr(0, pos);
+				auto value = line.substr(pos + 2);
+				if (key == "ETag") entry.etag = value;
+				else if (key == "Last-Modified")
+					entry.lastModified = value;
+				else if (key == "SHA256")
+					entry.sha256 = value;
+				else if (key == "Body")
+					entry.file = directory / value;
+			}
+			if (!std::filesystem::is_regular_file(entry.file)) return false;
+			return !entry.etag.empty() || !entry.lastModified.empty() || !entry.sha256.empty();
+		}
+
+		static std::string keyFor(std::string url) {
+			for (auto& c : url) {
+				if (!isalnum((unsigned char)c) && c != '.' && c != '-') c = '_';
+			}
+			return url;
+		}
+	};
+};// namespace deb
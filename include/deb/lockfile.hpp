@@ -0,0 +1,121 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <filesystem>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace deb {
+	// A resolved package pinned to one exact build, with every location its files go to.
+	struct LockedPackage {
+		std::string name;
+		std::string url;
+		std::string sha256 = "";// empty when the index had none, the download can't be verified then
+		uint64_t size = 0;
+		std::set<std::pair<std::string, std::string>> locations;
+	};
+
+	// The complete result of resolving an install, written so a later install can skip fetching indexes and resolving.
+	// Tab separated, packages sorted by name so a diff of two lockfiles shows exactly which builds changed.
+	class Lockfile {
+	public:
+		// by key(), one entry per .deb however many names it was reached through
+		std::map<std::string, LockedPackage> packages;
+
+		Lockfile() {}
+
+		// what identifies the .deb itself, its SHA256 or the url when the index had none
+		static std::string key(const LockedPackage& package) {
+			return package.sha256.empty() ? package.url : package.sha256;
+		}
+
+		// Adds package or, when it is already there, the locations it brings.
+		void add(const LockedPackage& package) {
+			auto [it, added] = packages.try_emplace(key(package), package);
+			if (!added) it->second.locations.insert(package.locations.begin(), package.locations.end());
+		}
+
+		void save(const std::filesystem::path& file) const {
+			auto tmp = file.string() + ".part";
+			{
+				std::ofstream out(tmp, std::ios::trunc);
+				out << "deb-lock\t1\n";
+				std::vector<const LockedPackage*> sorted;
+				for (auto& entry : packages) sorted.push_back(&entry.second);
+				std::sort(sorted.begin(), sorted.end(), [](auto* a, auto* b) {
+					return std::tie(a->name, a->url) < std::tie(b->name, b->url);
+				});
+				for (auto* entry : sorted) {
+					auto& package = *entry;
+					out << "package\t" << package.name << "\t" << package.size << "\t" << package.sha256 << "\t"
+						<< package.url << "\n";
+					for (auto& [source, destination] : package.locations)
+						out << "location\t" << source << "\t" << destination << "\n";
+				}
+				if (!out) throw std::runtime_error("Failed to write lockfile " + tmp);
+			}
+			std::filesystem::rename(tmp, file);
+		}
+
+		static Lockfile load(const std::filesystem::path& file) {
+			std::ifstream in(file);
+			std::string line;
+			if (!std::getline(in, line) || line != "deb-lock\t1")
+				throw std::runtime_error("Missing or unsupported lockfile " + file.string());
+			Lockfile lockfile;
+			LockedPackage* current = nullptr;
+			for (size_t number = 2; std::getline(in, line); number++) {
+				std::vector<std::string> fields;
+				std::stringstream ss(line);
+				std::string field;
+				while (std::getline(ss, field, '\t')) fields.push_back(field);
+				if (fields.size() == 5 && fields[0] == "package") {
+					LockedPackage package{fields[1], fields[4], fields[3], std::stoull(fields[2]), {}};
+					current = &lockfile.packages[key(package)];
+					*current = package;
+				} else if (current && fields.size() == 3 && fields[0] == "location") {
+					current->locations.insert({fields[1], fields[2]});
+				} else if (!line.empty()) {
+					throw std::runtime_error("Bad line " + std::to_string(number) + " in lockfile " + file.string());
+				}
+			}
+			return lockfile;
+		}
+	};
+};// namespace deb
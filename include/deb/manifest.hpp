@@ -0,0 +1,173 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace deb {
+	// A file or symlink a package put into a destination, path relative to the destination.
+	struct ManifestFile {
+		std::string path;
+		uint32_t mode = 0;
+		uint64_t size = 0;
+		std::string sha256 = "";
+		std::string linkTarget = "";// non empty for symlinks
+	};
+
+	struct ManifestPackage {
+		std::string name;
+		std::string id;// Packages SHA256 of the .deb, changes with every new build of the package
+		std::vector<ManifestFile> files;
+	};
+
+	// What extracting one package recorded, by destination. Held back until the package is verified.
+	using ManifestRecords = std::map<std::string, ManifestPackage>;
+
+	// What has been installed into one destination directory, kept in a tab separated file inside it.
+	// Lets a repeated install skip packages that haven't changed and leave files with identical contents untouched.
+	class InstallManifest {
+	public:
+		static constexpr const char* fileName = ".deb-manifest";
+
+		std::map<std::string, ManifestPackage> packages;
+
+		InstallManifest() {}
+		InstallManifest(std::filesystem::path destination) : destination(destination) { load(); }
+
+		std::filesystem::path path() const { return destination / fileName; }
+
+		const ManifestPackage* find(const std::string& name) const {
+			auto it = packages.find(name);
+			return it == packages.end() ? nullptr : &it->second;
+		}
+
+		const ManifestFile* findFile(const std::string& path) const {
+			auto it = owners.find(path);
+			if (it == owners.end()) return nullptr;
+			for (auto& file : packages.at(it->second).files)
+				if (file.path == path) return &file;
+			return nullptr;
+		}
+
+		// The package is recorded with this id and everything it installed is still there with the recorded size.
+		bool upToDate(const std::string& name, const std::string& id) const {
+			auto package = find(name);
+			if (!package || package->id != id) return false;
+			for (auto& file : package->files) {
+				std::error_code ec;
+				auto target = destination / file.path;
+				if (!file.linkTarget.empty()) {
+					if (std::filesystem::read_symlink(target, ec) != file.linkTarget || ec) return false;
+				} else if (std::filesystem::file_size(target, ec) != file.size || ec) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Records a new version of a package, returns the files the old version had that no package owns anymore.
+		std::vector<std::string> replace(ManifestPackage package) {
+			std::set<std::string> kept;
+			for (auto& file : package.files) kept.insert(file.path);
+			std::vector<std::string> stale;
+			auto old = packages.find(package.name);
+			if (old != packages.end()) {
+				for (auto& file : old->second.files) {
+					auto owner = owners.find(file.path);
+					if (!kept.count(file.path) && owner != owners.end() && owner->second == package.name) {
+						stale.push_back(file.path);
+						owners.erase(owner);
+					}
+				}
+			}
+			for (auto& file : package.files) owners[file.path] = package.name;
+			packages[package.name] = std::move(package);
+			return stale;
+		}
+
+		void save() const {
+			std::filesystem::create_directories(destination);
+			auto tmp = path().string() + ".part";
+			{
+				std::ofstream out(tmp, std::ios::trunc);
+				out << "deb-manifest\t1\n";
+				for (auto& [name, package] : packages) {
+					out << "package\t" << name << "\t" << package.id << "\n";
+					for (auto& file : package.files) {
+						if (file.linkTarget.empty())
+							out << "file\t" << std::oct << file.mode << std::dec << "\t" << file.size << "\t" << file.sha256
+								<< "\t" << file.path << "\n";
+						else
+							out << "link\t" << file.linkTarget << "\t" << file.path << "\n";
+					}
+				}
+				if (!out) throw std::runtime_error("Failed to write install manifest " + tmp);
+			}
+			std::filesystem::rename(tmp, path());
+		}
+
+	private:
+		std::filesystem::path destination;
+		std::map<std::string, std::string> owners;// path -> package
+
+		void load() {
+			std::ifstream in(path());
+			std::string line;
+			if (!std::getline(in, line) || line != "deb-manifest\t1") return;
+			ManifestPackage* current = nullptr;
+			while (std::getline(in, line)) {
+				std::vector<std::string> fields;
+				std::stringstream ss(line);
+				std::string field;
+				while (std::getline(ss, field, '\t')) fields.push_back(field);
+				if (fields.size() == 3 && fields[0] == "package") {
+					current = &packages[fields[1]];
+					current->name = fields[1];
+					current->id = fields[2];
+				} else if (current && fields.size() == 5 && fields[0] == "file") {
+					current->files.push_back(
+						{fields[4], uint32_t(std::stoul(fields[1], nullptr, 8)), std::stoull(fields[2]), fields[3], ""}
+					);
+					owners[fields[4]] = current->name;
+				} else if (current && fields.size() == 3 && fields[0] == "link") {
+					current->files.push_back({fields[2], 0, 0, "", fields[1]});
+					owners[fields[2]] = current->name;
+				}
+			}
+		}
+	};
+};// namespace deb
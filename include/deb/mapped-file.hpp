@@ -0,0 +1,98 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <fcntl.h>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace deb {
+	// Read-only memory mapping of a whole file, unmapped on destruction.
+	class MappedFile {
+	public:
+		MappedFile() {}
+		MappedFile(const std::filesystem::path& path) { open(path); }
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) { *this = std::move(other); }
+		MappedFile& operator=(MappedFile&& other) {
+			if (this != &other) {
+				close();
+				ptr = other.ptr;
+				len = other.len;
+				other.ptr = nullptr;
+				other.len = 0;
+			}
+			return *this;
+		}
+		~MappedFile() { close(); }
+
+		void open(const std::filesystem::path& path) {
+			close();
+			int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0) throw std::runtime_error("Failed to open " + path.string());
+			struct stat st;
+			if (fstat(fd, &st) != 0) {
+				::close(fd);
+				throw std::runtime_error("Failed to stat " + path.string());
+			}
+			len = size_t(st.st_size);
+			if (len > 0) {
+				void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p == MAP_FAILED) {
+					::close(fd);
+					len = 0;
+					throw std::runtime_error("Failed to map " + path.string());
+				}
+				ptr = (const char*)p;
+			}
+			::close(fd);
+		}
+
+		void close() {
+			if (ptr) munmap((void*)ptr, len);
+			ptr = nullptr;
+			len = 0;
+		}
+
+		const char* data() const { return ptr; }
+		size_t size() const { return len; }
+		bool isOpen() const { return ptr != nullptr; }
+
+	private:
+		const char* ptr = nullptr;
+		size_t len = 0;
+	};
+};// namespace deb
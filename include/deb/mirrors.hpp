@@ -0,0 +1,258 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace deb {
+	// Groups of repository base urls that serve the same files, plus latency and throughput seen per host.
+	// Downloads ask candidates() for every url able to serve a file, fastest first, and hedgeDelay() for how long
+	// to wait on the first one before sending a duplicate request to the next.
+	class MirrorSet {
+	public:
+		struct HostStats {
+			size_t requests = 0;
+			size_t failures = 0;
+			size_t consecutiveFailures = 0;
+			double bytesPerSecond = 0;// moving average over transfers of at least 64 KiB
+			std::vector<double> latencies;// seconds to the response headers, the last latencySamples of them
+			size_t nextLatency = 0;
+		};
+
+		// duplicate requests go out once the first candidate is slower than this percentile of its host's latencies
+		bool hedge = true;
+		double hedgePercentile = 0.95;
+		// a host needs this many latency samples before its percentile is trusted
+		size_t minSamples = 16;
+		size_t latencySamples = 128;
+
+		MirrorSet() {}
+		MirrorSet(const MirrorSet&) = delete;
+		MirrorSet& operator=(const MirrorSet&) = delete;
+
+		// Marks every url in bases as serving the same files under the same paths, merging with existing groups.
+		void addGroup(const std::vector<std::string>& bases) {
+			for (size_t i = 1; i < bases.size(); i++) link(bases[0], bases[i]);
+		}
+
+		void link(std::string a, std::string b) {
+			trimSlash(a), trimSlash(b);
+			if (a == b) return;
+			std::lock_guard<std::mutex> lock(mtx);
+			size_t ga = groupOf(a), gb = groupOf(b);
+			if (ga != npos && ga == gb) return;
+			if (ga == npos && gb == npos) {
+				groups.push_back({a, b});
+			} else if (ga == npos) {
+				groups[gb].insert(a);
+			} else if (gb == npos) {
+				groups[ga].insert(b);
+			} else {
+				groups[ga].insert(groups[gb].begin(), groups[gb].end());
+				groups.erase(groups.begin() + gb);
+			}
+		}
+
+		bool sameGroup(std::string a, std::string b) {
+			trimSlash(a), trimSlash(b);
+			std::lock_guard<std::mutex> lock(mtx);
+			size_t g = groupOf(a);
+			return a == b || (g != npos && groups[g].count(b));
+		}
+
+		std::vector<std::vector<std::string>> allGroups() {
+			std::lock_guard<std::mutex> lock(mtx);
+			std::vector<std::vector<std::string>> result;
+			for (auto& group : groups) result.emplace_back(group.begin(), group.end());
+			return result;
+		}
+
+		// Every url serving the same file as url, url itself included, best expected time for size bytes first.
+		// Hosts nobody has measured yet rank first so each mirror gets sampled, ties keep url in front.
+		std::vector<std::string> candidates(const std::string& url, uint64_t size = 0) {
+			std::lock_guard<std::mutex> lock(mtx);
+			std::vector<std::string> result = {url};
+			for (auto& group : groups) {
+				for (auto& base : group) {
+					if (url.size() <= base.size() || url.compare(0, base.size(), base) != 0 || url[base.size()] != '/')
+						continue;
+					std::string relative = url.substr(base.size());
+					for (auto& other : group)
+						if (other != base) result.push_back(other + relative);
+					break;
+				}
+			}
+			if (result.size() == 1) return result;
+			std::vector<double> scores;
+			for (auto& candidate : result) scores.push_back(score(hostOf(candidate), size));
+			std::vector<size_t> order(result.size());
+			for (size_t i = 0; i < order.size(); i++) order[i] = i;
+			std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scores[a] < scores[b]; });
+			std::vector<std::string> sorted;
+			for (auto i : order) sorted.push_back(result[i]);
+			return sorted;
+		}
+
+		// Seconds to wait for url's host before hedging, negative when hedging is off or the host is not known well.
+		double hedgeDelay(const std::string& url) {
+			if (!hedge) return -1;
+			std::lock_guard<std::mutex> lock(mtx);
+			auto it = hosts.find(hostOf(url));
+			if (it == hosts.end() || it->second.latencies.size() < minSamples) return -1;
+			return percentile(it->second.latencies, hedgePercentile);
+		}
+
+		void recordLatency(const std::string& url, double seconds) {
+			std::lock_guard<std::mutex> lock(mtx);
+			auto& host = hosts[hostOf(url)];
+			host.requests++;
+			host.consecutiveFailures = 0;
+			if (host.latencies.size() < latencySamples) host.latencies.push_back(seconds);
+			else
+				host.latencies[host.nextLatency++ % latencySamples] = seconds;
+		}
+
+		void recordTransfer(const std::string& url, uint64_t bytes, double seconds) {
+			if (bytes < (64 << 10) || seconds <= 0) return;
+			std::lock_guard<std::mutex> lock(mtx);
+			auto& host = hosts[hostOf(url)];
+			double rate = bytes / seconds;
+			host.bytesPerSecond = host.bytesPerSecond == 0 ? rate : 0.7 * host.bytesPerSecond + 0.3 * rate;
+		}
+
+		void recordFailure(const std::string& url) {
+			std::lock_guard<std::mutex> lock(mtx);
+			auto& host = hosts[hostOf(url)];
+			host.failures++;
+			host.consecutiveFailures++;
+		}
+
+		void recordHedge() { hedgeCount++; }
+		void recordHedgeWin() { hedgeWinCount++; }
+		size_t hedges() const { return hedgeCount; }
+		size_t hedgeWins() const { return hedgeWinCount; }
+
+		std::map<std::string, HostStats> stats() {
+			std::lock_guard<std::mutex> lock(mtx);
+			return hosts;
+		}
+
+		// one line per host: requests, failures, median and p95 latency, throughput
+		std::string report() {
+			std::lock_guard<std::mutex> lock(mtx);
+			std::stringstream ss;
+			for (auto& [name, host] : hosts) {
+				ss << "mirror " << name << ": " << host.requests << " requests, " << host.failures << " failures";
+				if (!host.latencies.empty())
+					ss << ", latency p50 " << percentile(host.latencies, 0.5) * 1000 << " ms p95 "
+					   << percentile(host.latencies, 0.95) * 1000 << " ms";
+				if (host.bytesPerSecond > 0) ss << ", " << host.bytesPerSecond / 1e6 << " MB/s";
+				ss << "\n";
+			}
+			if (hedgeCount > 0)
+				ss << "hedged " << hedgeCount << " requests, " << hedgeWinCount << " won by the hedge\n";
+			return ss.str();
+		}
+
+		// Groups only, the statistics describe this run's network and are not kept. One group per line, tab separated.
+		void save(const std::filesystem::path& file) {
+			std::ofstream out(file, std::ios::trunc);
+			for (auto& group : allGroups()) {
+				for (size_t i = 0; i < group.size(); i++) out << (i ? "\t" : "") << group[i];
+				out << "\n";
+			}
+		}
+
+		void load(const std::filesystem::path& file) {
+			std::ifstream in(file);
+			std::string line;
+			while (std::getline(in, line)) {
+				std::vector<std::string> group;
+				std::stringstream ss(line);
+				std::string base;
+				while (std::getline(ss, base, '\t'))
+					if (!base.empty()) group.push_back(base);
+				addGroup(group);
+			}
+		}
+
+		// scheme + host (+ port) of url, the unit statistics are kept for
+		static std::string hostOf(const std::string& url) {
+			size_t start = url.find("://");
+			start = start == std::string::npos ? 0 : start + 3;
+			return url.substr(0, url.find('/', start));
+		}
+
+	private:
+		static constexpr size_t npos = SIZE_MAX;
+		std::mutex mtx;
+		std::vector<std::set<std::string>> groups;
+		std::map<std::string, HostStats> hosts;
+		std::atomic_size_t hedgeCount{0};
+		std::atomic_size_t hedgeWinCount{0};
+
+		static void trimSlash(std::string& url) {
+			while (!url.empty() && url.back() == '/') url.pop_back();
+		}
+
+		size_t groupOf(const std::string& base) {
+			for (size_t i = 0; i < groups.size(); i++)
+				if (groups[i].count(base)) return i;
+			return npos;
+		}
+
+		static double percentile(std::vector<double> values, double p) {
+			size_t k = std::min(values.size() - 1, size_t(p * values.size()));
+			std::nth_element(values.begin(), values.begin() + k, values.end());
+			return values[k];
+		}
+
+		// expected seconds to fetch size bytes, hosts that keep failing sink to the back
+		double score(const std::string& name, uint64_t size) {
+			auto it = hosts.find(name);
+			if (it == hosts.end()) return 0;
+			auto& host = it->second;
+			double expected = host.latencies.empty() ? 0 : percentile(host.latencies, 0.5);
+			if (size > 0 && host.bytesPerSecond > 0) expected += size / host.bytesPerSecond;
+			if (host.consecutiveFailures > 0) expected = (std::max(expected, 1.0)) * (1 + host.consecutiveFailures);
+			return expected;
+		}
+	};
+};// namespace deb
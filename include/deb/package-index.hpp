@@ -0,0 +1,535 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <deb/mapped-file.hpp>
+#include <deb/packages-parser.hpp>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace deb {
+	// Compact name -> .deb lookup table built from Packages indexes.
+	// Every distinct string lives once in a single arena (a Depends line or version shared by many packages too),
+	// lookups go through a flat open addressing table, and the whole thing can be saved to disk and mmap'ed back read-only.
+	class PackageIndex {
+	public:
+		struct StringRef {
+			uint32_t offset = 0;
+			uint32_t size = 0;
+		};
+		// one per Packages stanza
+		struct Package {
+			StringRef name;
+			uint32_t prefix = 0;
+			StringRef path;
+			StringRef version;
+			// raw Depends-style fields, the resolver parses them on demand
+			StringRef depends;
+			StringRef preDepends;
+			StringRef recommends;
+			StringRef suggests;
+			uint32_t reserved = 0;// what would be padding, so snapshots never contain uninitialized bytes
+			uint64_t size = 0;
+			uint8_t sha256[32] = {};// all zero when the stanza had no SHA256 field
+		};
+		// one per name a package can be installed by: its own name, Provides and Source
+		struct Name {
+			StringRef name;
+			uint32_t hash = 0;
+			uint32_t package = 0;
+		};
+		// save() writes these as they are in memory
+		static_assert(std::has_unique_object_representations_v<Package>, "Package must not have padding");
+		static_assert(std::has_unique_object_representations_v<Name>, "Name must not have padding");
+
+		PackageIndex() {}
+		PackageIndex(const PackageIndex& other) { *this = other; }
+		PackageIndex& operator=(const PackageIndex& other) {
+			if (this == &other) return *this;
+			mapping.close();
+			strings.assign(other.stringData, other.stringData + other.stringCount);
+			prefixes.assign(other.prefixData, other.prefixData + other.prefixCount);
+			packages.assign(other.packageData, other.packageData + other.packageCount);
+			names.assign(other.nameData, other.nameData + other.nameCount);
+			slots.assign(other.slotData, other.slotData + other.slotCount);
+			// dedup starts over, strings interned from now on may repeat earlier ones
+			interned.clear();
+			internSlots.clear();
+			refreshView();
+			return *this;
+		}
+		PackageIndex(PackageIndex&& other) { *this = std::move(other); }
+		PackageIndex& operator=(PackageIndex&& other) {
+			if (this == &other) return *this;
+			bool mapped = other.mapping.isOpen();
+			mapping = std::move(other.mapping);
+			strings = std::move(other.strings);
+			prefixes = std::move(other.prefixes);
+			packages = std::move(other.packages);
+			names = std::move(other.names);
+			slots = std::move(other.slots);
+			interned = std::move(other.interned);
+			internSlots = std::move(other.internSlots);
+			if (mapped) {
+				// the views still point into the mapping we just took over
+				stringData = other.stringData, stringCount = other.stringCount;
+				prefixData = other.prefixData, prefixCount = other.prefixCount;
+				packageData = other.packageData, packageCount = other.packageCount;
+				nameData = other.nameData, nameCount = other.nameCount;
+				slotData = other.slotData, slotCount = other.slotCount;
+			} else {
+				refreshView();
+			}
+			other.clear();
+			return *this;
+		}
+
+		bool empty() const { return nameCount == 0; }
+		size_t size() const { return nameCount; }
+		size_t packagesSize() const { return packageCount; }
+		bool isMapped() const { return mapping.isOpen(); }
+
+		void clear() {
+			mapping.close();
+			strings.clear();
+			prefixes.clear();
+			packages.clear();
+			names.clear();
+			slots.clear();
+			interned.clear();
+			internSlots.clear();
+			refreshView();
+		}
+
+		std::string_view str(StringRef ref) const { return std::string_view(stringData + ref.offset, ref.size); }
+
+		const Package* find(std::string_view name) const {
+			if (slotCount == 0) return nullptr;
+			uint32_t h = hash(name);
+			size_t mask = slotCount - 1;
+			for (size_t i = h & mask;; i = (i + 1) & mask) {
+				uint32_t slot = slotData[i];
+				if (slot == 0) return nullptr;
+				const Name& n = nameData[slot - 1];
+				if (n.hash == h && str(n.name) == name) return &packageData[n.package];
+			}
+		}
+
+		bool count(std::string_view name) const { return find(name) != nullptr; }
+
+		// stanzas in insertion order, i < packagesSize(). The position is the package's id
+		const Package& package(size_t i) const { return packageData[i]; }
+		uint32_t id(const Package& pkg) const { return uint32_t(&pkg - packageData); }
+
+		// the repository base url pkg was listed under
+		std::string_view prefix(const Package& pkg) const { return str(prefixData[pkg.prefix]); }
+
+		std::string url(const Package& pkg) const {
+			std::string result;
+			auto prefix = str(prefixData[pkg.prefix]);
+			auto path = str(pkg.path);
+			result.reserve(prefix.size() + 1 + path.size());
+			result.append(prefix).append("/").append(path);
+			return result;
+		}
+
+		// lowercase hex like in the Packages file, empty if unknown
+		static std::string sha256(const Package& pkg) {
+			static const char* digits = "0123456789abcdef";
+			bool known = false;
+			for (auto b : pkg.sha256) known = known || b != 0;
+			if (!known) return "";
+			std::string result;
+			for (auto b : pkg.sha256) {
+				result += digits[b >> 4];
+				result += digits[b & 0xf];
+			}
+			return result;
+		}
+
+		std::string url(std::string_view name) const {
+			auto* pkg = find(name);
+			return pkg ? url(*pkg) : "";
+		}
+
+		uint32_t addPrefix(std::string_view prefix) {
+			for (size_t i = 0; i < prefixCount; i++) {
+				if (str(prefixData[i]) == prefix) return uint32_t(i);
+			}
+			makeWritable();
+			prefixes.push_back(intern(prefix));
+			refreshView();
+			return uint32_t(prefixes.size() - 1);
+		}
+
+		// Adds a Packages stanza from the repository at prefix. The package is reachable by its name, Provides and Source,
+		// names that are already taken keep pointing to their first package.
+		// Returns false (and stores nothing) for malformed stanzas and when every name was taken.
+		bool addStanza(uint32_t prefix, std::string_view stanza) {
+			auto name = findField(stanza, "Package");
+			auto path = findField(stanza, "Filename");
+			if (name.empty() || path.empty()) return false;
+
+			auto aliases = splitDependencyNames(findField(stanza, "Provides"));
+			auto source = splitDependencyNames(findField(stanza, "Source"));
+			aliases.insert(aliases.end(), source.begin(), source.end());
+
+			bool anyNew = !count(name);
+			for (auto& alias : aliases) anyNew = anyNew || !count(alias);
+			if (!anyNew) return false;
+
+			makeWritable();
+			Package pkg;
+			pkg.name = append(name);
+			pkg.prefix = prefix;
+			pkg.path = append(path);
+			pkg.version = intern(findField(stanza, "Version"));
+			pkg.depends = intern(findField(stanza, "Depends"));
+			pkg.preDepends = intern(findField(stanza, "Pre-Depends"));
+			pkg.recommends = intern(findField(stanza, "Recommends"));
+			pkg.suggests = intern(findField(stanza, "Suggests"));
+			auto size = findField(stanza, "Size");
+			std::from_chars(size.data(), size.data() + size.size(), pkg.size);
+			parseSha256(findField(stanza, "SHA256"), pkg.sha256);
+			packages.push_back(pkg);
+			refreshView();
+
+			uint32_t id = uint32_t(packages.size() - 1);
+			for (auto& alias : aliases) addName(alias, id);
+			addName(name, id);
+			return true;
+		}
+
+		// Copies everything from other whose name is not taken yet, so earlier sources win like map::insert would.
+		void merge(const PackageIndex& other) {
+			if (other.empty()) return;
+			makeWritable();
+			std::vector<uint32_t> remap(other.packageCount, UINT32_MAX);
+			std::vector<uint32_t> prefixRemap(other.prefixCount, UINT32_MAX);
+			for (size_t i = 0; i < other.nameCount; i++) {
+				const Name& n = other.nameData[i];
+				auto name = other.str(n.name);
+				if (count(name)) continue;
+				if (remap[n.package] == UINT32_MAX) {
+					const Package& src = other.packageData[n.package];
+					if (prefixRemap[src.prefix] == UINT32_MAX)
+						prefixRemap[src.prefix] = addPrefix(other.str(other.prefixData[src.prefix]));
+					Package pkg;
+					pkg.name = append(other.str(src.name));
+					pkg.prefix = prefixRemap[src.prefix];
+					pkg.path = append(other.str(src.path));
+					pkg.version = intern(other.str(src.version));
+					pkg.depends = intern(other.str(src.depends));
+					pkg.preDepends = intern(other.str(src.preDepends));
+					pkg.recommends = intern(other.str(src.recommends));
+					pkg.suggests = intern(other.str(src.suggests));
+					pkg.size = src.size;
+					std::memcpy(pkg.sha256, src.sha256, sizeof(pkg.sha256));
+					packages.push_back(pkg);
+					refreshView();
+					remap[n.package] = uint32_t(packages.size() - 1);
+				}
+				addName(name, remap[n.package]);
+			}
+		}
+
+		size_t memoryUsage() const {
+			return stringCount + prefixCount * sizeof(StringRef) + packageCount * sizeof(Package) +
+				   nameCount * sizeof(Name) + slotCount * sizeof(uint32_t);
+		}
+
+		// Writes a snapshot that load() can map back. key identifies the inputs the index was built from.
+		void save(const std::filesystem::path& file, std::string_view key) const {
+			Header header;
+			header.keySize = uint32_t(key.size());
+			header.stringCount = stringCount;
+			header.prefixCount = prefixCount;
+			header.packageCount = packageCount;
+			header.nameCount = nameCount;
+			header.slotCount = slotCount;
+
+			std::filesystem::create_directories(file.parent_path());
+			auto tmp = file.string() + ".part";
+			{
+				std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+				auto write = [&](const void* data, size_t size) {
+					out.write((const char*)data, size);
+					static const char zeros[8] = {};
+					out.write(zeros, pad(size) - size);
+				};
+				write(&header, sizeof(header));
+				write(key.data(), key.size());
+				write(stringData, stringCount);
+				write(prefixData, prefixCount * sizeof(StringRef));
+				write(packageData, packageCount * sizeof(Package));
+				write(nameData, nameCount * sizeof(Name));
+				write(slotData, slotCount * sizeof(uint32_t));
+				if (!out) throw std::runtime_error("Failed to write package index " + tmp);
+			}
+			std::filesystem::rename(tmp, file);
+		}
+
+		// Maps a snapshot written by save(). Returns false if it is missing, from another format version or built from other inputs.
+		bool load(const std::filesystem::path& file, std::string_view key) {
+			if (!std::filesystem::is_regular_file(file)) return false;
+			MappedFile map(file);
+			if (map.size() < sizeof(Header)) return false;
+
+			Header header;
+			std::memcpy(&header, map.data(), sizeof(header));
+			if (std::memcmp(header.magic, Header().magic, sizeof(header.magic)) != 0) return false;
+			if (header.version != Header().version) return false;
+
+			// counts from a damaged file could overflow the sizes computed from them
+			for (uint64_t count : {header.stringCount, header.prefixCount, header.packageCount, header.nameCount,
+								   header.slotCount})
+				if (count > map.size()) return false;
+
+			size_t offset = pad(sizeof(Header));
+			if (header.keySize != key.size() || map.size() < offset + key.size()) return false;
+			if (std::memcmp(map.data() + offset, key.data(), key.size()) != 0) return false;
+			offset += pad(key.size());
+
+			size_t expected = offset + pad(header.stringCount) + pad(header.prefixCount * sizeof(StringRef)) +
+							  pad(header.packageCount * sizeof(Package)) + pad(header.nameCount * sizeof(Name)) +
+							  pad(header.slotCount * sizeof(uint32_t));
+			if (map.size() != expected) return false;
+			if (header.slotCount & (header.slotCount - 1)) return false;
+
+			const char* base = map.data() + offset + pad(header.stringCount);
+			auto prefixView = (const StringRef*)base;
+			base += pad(header.prefixCount * sizeof(StringRef));
+			auto packageView = (const Package*)base;
+			base += pad(header.packageCount * sizeof(Package));
+			auto nameView = (const Name*)base;
+			base += pad(header.nameCount * sizeof(Name));
+			auto slotView = (const uint32_t*)base;
+			if (!valid(header, prefixView, packageView, nameView, slotView)) return false;
+
+			clear();
+			stringData = map.data() + offset, stringCount = header.stringCount;
+			prefixData = prefixView, prefixCount = header.prefixCount;
+			packageData = packageView, packageCount = header.packageCount;
+			nameData = nameView, nameCount = header.nameCount;
+			slotData = slotView, slotCount = header.slotCount;
+			mapping = std::move(map);
+			return true;
+		}
+
+	private:
+		struct Header {
+			char magic[8] = {'D', 'E', 'B', 'I', 'D', 'X', '\0', '\0'};
+			uint32_t version = 3;
+			uint32_t keySize = 0;
+			uint64_t stringCount = 0;
+			uint64_t prefixCount = 0;
+			uint64_t packageCount = 0;
+			uint64_t nameCount = 0;
+			uint64_t slotCount = 0;
+		};
+		static_assert(std::has_unique_object_representations_v<Header>, "Header must not have padding");
+
+		// one per distinct string in the arena, found through internSlots (index + 1, 0 is an empty slot).
+		// Only what was interned since the index was last built, copied or mapped, never part of a snapshot
+		struct Interned {
+			StringRef ref;
+			uint32_t hash = 0;
+		};
+		std::vector<Interned> interned;
+		std::vector<uint32_t> internSlots;
+
+		// owned storage, empty while the index is mapped from a snapshot
+		std::vector<char> strings;
+		std::vector<StringRef> prefixes;
+		std::vector<Package> packages;
+		std::vector<Name> names;
+		std::vector<uint32_t> slots;// name index + 1, 0 is an empty slot
+		MappedFile mapping;
+
+		// what lookups actually read, points either into the vectors above or into the mapping
+		const char* stringData = nullptr;
+		size_t stringCount = 0;
+		const StringRef* prefixData = nullptr;
+		size_t prefixCount = 0;
+		const Package* packageData = nullptr;
+		size_t packageCount = 0;
+		const Name* nameData = nullptr;
+		size_t nameCount = 0;
+		const uint32_t* slotData = nullptr;
+		size_t slotCount = 0;
+
+		static size_t pad(size_t size) { return (size + 7) & ~size_t(7); }
+
+		static void parseSha256(std::string_view hex, uint8_t* out) {
+			if (hex.size() != 64) return;
+			auto nibble = [](char c) -> int {
+				if (c >= '0' && c <= '9') return c - '0';
+				if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+				if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+				return -1;
+			};
+			uint8_t digest[32];
+			for (size_t i = 0; i < 32; i++) {
+				int hi = nibble(hex[2 * i]), lo = nibble(hex[2 * i + 1]);
+				if (hi < 0 || lo < 0) return;
+				digest[i] = uint8_t(hi << 4 | lo);
+			}
+			std::memcpy(out, digest, 32);
+		}
+
+		static uint32_t hash(std::string_view s) {
+			uint32_t h = 2166136261u;// FNV-1a
+			for (unsigned char c : s) h = (h ^ c) * 16777619u;
+			return h;
+		}
+
+		void refreshView() {
+			stringData = strings.data(), stringCount = strings.size();
+			prefixData = prefixes.data(), prefixCount = prefixes.size();
+			packageData = packages.data(), packageCount = packages.size();
+			nameData = names.data(), nameCount = names.size();
+			slotData = slots.data(), slotCount = slots.size();
+		}
+
+		// copy a mapped snapshot into owned storage before the first modification
+		void makeWritable() {
+			if (!mapping.isOpen()) return;
+			strings.assign(stringData, stringData + stringCount);
+			prefixes.assign(prefixData, prefixData + prefixCount);
+			packages.assign(packageData, packageData + packageCount);
+			names.assign(nameData, nameData + nameCount);
+			slots.assign(slotData, slotData + slotCount);
+			mapping.close();
+			refreshView();
+		}
+
+		// Stores s at the end of the arena. For names and paths, which are unique per package and not worth hashing.
+		StringRef append(std::string_view s) {
+			if (s.empty()) return StringRef{};
+			if (strings.size() + s.size() > UINT32_MAX) throw std::runtime_error("Package index string arena overflow");
+			StringRef ref{uint32_t(strings.size()), uint32_t(s.size())};
+			strings.insert(strings.end(), s.begin(), s.end());
+			refreshView();
+			return ref;
+		}
+
+		// The copy of s already in the arena, or a new one. For versions, dependency fields, aliases and prefixes.
+		StringRef intern(std::string_view s) {
+			if (s.empty()) return StringRef{};
+			if ((interned.size() + 1) * 10 > internSlots.size() * 7)
+				rehashInterned(internSlots.empty() ? 4096 : internSlots.size() * 2);
+			uint32_t h = hash(s);
+			size_t mask = internSlots.size() - 1;
+			size_t i = h & mask;
+			for (; internSlots[i] != 0; i = (i + 1) & mask) {
+				const Interned& known = interned[internSlots[i] - 1];
+				if (known.hash == h && str(known.ref) == s) return known.ref;
+			}
+
+			StringRef ref = append(s);
+			interned.push_back({ref, h});
+			internSlots[i] = uint32_t(interned.size());
+			return ref;
+		}
+
+		void rehashInterned(size_t size) {
+			internSlots.assign(size, 0);
+			size_t mask = size - 1;
+			for (size_t k = 0; k < interned.size(); k++) {
+				size_t i = interned[k].hash & mask;
+				while (internSlots[i] != 0) i = (i + 1) & mask;
+				internSlots[i] = uint32_t(k + 1);
+			}
+		}
+
+		// Every reference in a snapshot stays inside the snapshot, a damaged file is rejected instead of read past.
+		static bool valid(
+			const Header& header,
+			const StringRef* prefixes,
+			const Package* packages,
+			const Name* names,
+			const uint32_t* slots
+		) {
+			auto fits = [&](StringRef ref) { return uint64_t(ref.offset) + ref.size <= header.stringCount; };
+			for (size_t i = 0; i < header.prefixCount; i++)
+				if (!fits(prefixes[i])) return false;
+			for (size_t i = 0; i < header.packageCount; i++) {
+				auto& pkg = packages[i];
+				if (!fits(pkg.name) || !fits(pkg.path) || !fits(pkg.version) || !fits(pkg.depends) ||
+					!fits(pkg.preDepends) || !fits(pkg.recommends) || !fits(pkg.suggests) ||
+					pkg.prefix >= header.prefixCount)
+					return false;
+			}
+			for (size_t i = 0; i < header.nameCount; i++)
+				if (!fits(names[i].name) || names[i].package >= header.packageCount) return false;
+			for (size_t i = 0; i < header.slotCount; i++)
+				if (slots[i] > header.nameCount) return false;
+			return true;
+		}
+
+		bool addName(std::string_view name, uint32_t package) {
+			if (count(name)) return false;
+			if ((names.size() + 1) * 10 > slots.size() * 7) rehash(slots.empty() ? 1024 : slots.size() * 2);
+
+			Name n;
+			n.hash = hash(name);
+			n.package = package;
+			// a package's own name is already in the arena
+			n.name = str(packages[package].name) == name ? packages[package].name : intern(name);
+			names.push_back(n);
+
+			size_t mask = slots.size() - 1;
+			size_t i = n.hash & mask;
+			while (slots[i] != 0) i = (i + 1) & mask;
+			slots[i] = uint32_t(names.size());
+			refreshView();
+			return true;
+		}
+
+		void rehash(size_t size) {
+			slots.assign(size, 0);
+			size_t mask = size - 1;
+			for (size_t k = 0; k < names.size(); k++) {
+				size_t i = names[k].hash & mask;
+				while (slots[i] != 0) i = (i + 1) & mask;
+				slots[i] = uint32_t(k + 1);
+			}
+			refreshView();
+		}
+	};
+};// namespace deb
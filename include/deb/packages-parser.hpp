@@ -0,0 +1,139 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <strings.h>
+#include <vector>
+
+namespace deb {
+	// Looks up a field of a deb822 paragraph (Packages stanza, control file, Release file) without copying it.
+	// The value spans continuation lines, leading blanks are trimmed. Returns an empty view when the field is missing.
+	inline std::string_view findField(std::string_view stanza, std::string_view name) {
+		const char* begin = stanza.data();
+		const char* end = begin + stanza.size();
+		const char* line = begin;
+		while (line < end) {
+			const char* eol = (const char*)memchr(line, '\n', end - line);
+			if (!eol) eol = end;
+
+			if (size_t(eol - line) > name.size() && line[name.size()] == ':' &&
+				strncasecmp(line, name.data(), name.size()) == 0) {
+				const char* value = line + name.size() + 1;
+				while (value < eol && (*value == ' ' || *value == '\t')) value++;
+				const char* valueEnd = eol;
+				// folded fields continue on lines starting with a blank
+				while (valueEnd < end && valueEnd + 1 < end && (valueEnd[1] == ' ' || valueEnd[1] == '\t')) {
+					const char* next = (const char*)memchr(valueEnd + 1, '\n', end - valueEnd - 1);
+					valueEnd = next ? next : end;
+				}
+				while (valueEnd > value && (valueEnd[-1] == '\r' || valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) valueEnd--;
+				return std::string_view(value, valueEnd - value);
+			}
+			line = eol + 1;
+		}
+		return std::string_view();
+	}
+
+	// Splits a Depends-style field ("a (>= 1.0) | b:any, c [amd64]") into bare package names.
+	// Every alternative is returned, version constraints, arch qualifiers and restrictions are dropped.
+	inline std::vector<std::string> splitDependencyNames(std::string_view value) {
+		std::vector<std::string> result;
+		size_t i = 0;
+		while (i < value.size()) {
+			while (i < value.size() && (value[i] == ' ' || value[i] == '\t' || value[i] == '\n' || value[i] == '\r')) i++;
+			size_t start = i;
+			while (i < value.size() && !strchr(" \t\r\n(:[<,|", value[i])) i++;
+			if (i > start) result.emplace_back(value.substr(start, i - start));
+			while (i < value.size() && value[i] != ',' && value[i] != '|') i++;
+			i++;
+		}
+		return result;
+	}
+
+	// Incremental splitter for Packages files. Decompressed chunks are fed as they arrive and every complete
+	// stanza is handed to the callback as a view into the internal buffer, only the current partial stanza is retained.
+	class PackagesParser {
+	public:
+		PackagesParser(std::function<void(std::string_view)> onStanza) : onStanza(onStanza) {}
+
+		void feed(const char* data, size_t size) {
+			buffer.append(data, size);
+
+			const char* begin = buffer.data();
+			const char* end = begin + buffer.size();
+			const char* stanzaStart = begin;
+			const char* cursor = begin + scanned;
+			while (cursor < end) {
+				const char* nl = (const char*)memchr(cursor, '\n', end - cursor);
+				if (!nl || nl + 1 >= end || (nl[1] == '\r' && nl + 2 >= end)) {
+					cursor = nl ? nl : end;
+					break;
+				}
+				if (nl[1] == '\n' || (nl[1] == '\r' && nl + 2 < end && nl[2] == '\n')) {
+					emit(stanzaStart, nl);
+					stanzaStart = nl + (nl[1] == '\n' ? 2 : 3);
+					cursor = stanzaStart;
+				} else {
+					cursor = nl + 1;
+				}
+			}
+
+			// rescan from the last newline next time, it may be the first half of a separator
+			scanned = size_t(cursor - stanzaStart);
+			buffer.erase(0, stanzaStart - begin);
+		}
+
+		void finish() {
+			emit(buffer.data(), buffer.data() + buffer.size());
+			buffer.clear();
+			scanned = 0;
+		}
+
+		size_t count() { return stanzas; }
+
+	private:
+		std::function<void(std::string_view)> onStanza;
+		std::string buffer;
+		size_t scanned = 0;
+		size_t stanzas = 0;
+
+		void emit(const char* begin, const char* end) {
+			while (begin < end && (*begin == '\n' || *begin == '\r')) begin++;
+			if (begin == end) return;
+			stanzas++;
+			onStanza(std::string_view(begin, end - begin));
+		}
+	};
+};// namespace deb
@@ -0,0 +1,188 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <deb/packages-parser.hpp>
+#include <deb/release.hpp>
+
+namespace deb {
+	// Packages.diff/Index: the hashes of past versions of an index and the patches that bring each of them up to date.
+	struct PdiffIndex {
+		ChecksumEntry current;
+		std::vector<ChecksumEntry> history;
+		std::vector<ChecksumEntry> patches;// uncompressed patch hashes, aligned with history
+		std::vector<ChecksumEntry> downloads;// compressed patch files as served
+		// merged patches go from their history entry straight to current instead of to the next entry
+		bool merged = false;
+
+		static PdiffIndex parse(std::string_view text) {
+			PdiffIndex index;
+			auto current = parseChecksumList(std::string(findField(text, "SHA256-Current")) + " current");
+			if (!current.empty()) index.current = current.front();
+			index.history = parseChecksumList(findField(text, "SHA256-History"));
+			index.patches = parseChecksumList(findField(text, "SHA256-Patches"));
+			index.downloads = parseChecksumList(findField(text, "SHA256-Download"));
+			index.merged = findField(text, "X-Patch-Precedence") == "merged";
+			return index;
+		}
+
+		// Patches that turn the version with hash `have` into current, in the order they have to be applied.
+		// Returns false if `have` is not in the history (too old, or not a version the repository ever served).
+		bool chain(const std::string& have, std::vector<const ChecksumEntry*>& result) const {
+			result.clear();
+			if (have == current.sha256) return true;
+			if (history.size() != patches.size()) return false;
+			for (size_t i = 0; i < history.size(); i++) {
+				if (history[i].sha256 != have) continue;
+				if (merged) result.push_back(&patches[i]);
+				else
+					for (size_t k = i; k < patches.size(); k++) result.push_back(&patches[k]);
+				return true;
+			}
+			return false;
+		}
+
+		// The compressed file a patch is served as, null for indexes that predate SHA256-Download.
+		const ChecksumEntry* download(const std::string& patch) const {
+			for (auto& entry : downloads) {
+				if (entry.name.size() > patch.size() && entry.name.compare(0, patch.size(), patch) == 0 &&
+					entry.name[patch.size()] == '.')
+					return &entry;
+			}
+			return nullptr;
+		}
+	};
+
+	// Applies the ed scripts (`diff --ed` output) pdiffs are made of. The file is held as line views into the
+	// original and the patch texts, each patch is applied in a single merge pass instead of editing line by line.
+	class EdPatcher {
+	public:
+		EdPatcher(std::string original) { lines = splitLines(keep(std::move(original))); }
+
+		void apply(std::string patch) {
+			std::string_view script = keep(std::move(patch));
+			std::vector<Command> commands;
+			auto patchLines = splitLines(script);
+			for (size_t i = 0; i < patchLines.size();) {
+				Command command = parseCommand(patchLines[i++]);
+				if (command.op != 'd') {
+					size_t textStart = i;
+					while (i < patchLines.size() && patchLines[i] != ".") i++;
+					if (i == patchLines.size()) throw std::runtime_error("unterminated text in ed script");
+					command.text.assign(patchLines.begin() + textStart, patchLines.begin() + i);
+					i++;
+				}
+				// diff --ed works bottom up, so every address still refers to the unpatched file
+				if (!commands.empty() && command.first >= commands.back().first)
+					throw std::runtime_error("ed script is not in descending order");
+				commands.push_back(std::move(command));
+			}
+
+			std::vector<std::string_view> result;
+			result.reserve(lines.size());
+			size_t copied = 0;
+			for (auto it = commands.rbegin(); it != commands.rend(); it++) {
+				// a appends after line first, c and d replace lines [first, last]
+				size_t keepUntil = it->op == 'a' ? it->first : it->first - 1;
+				size_t resumeAt = it->op == 'a' ? it->first : it->last;
+				if (keepUntil < copied || resumeAt > lines.size()) throw std::runtime_error("ed script does not fit the file");
+				result.insert(result.end(), lines.begin() + copied, lines.begin() + keepUntil);
+				result.insert(result.end(), it->text.begin(), it->text.end());
+				copied = resumeAt;
+			}
+			result.insert(result.end(), lines.begin() + copied, lines.end());
+			lines = std::move(result);
+		}
+
+		std::string result() const {
+			size_t size = 0;
+			for (auto line : lines) size += line.size() + 1;
+			std::string out;
+			out.reserve(size);
+			for (auto line : lines) {
+				out.append(line.data(), line.size());
+				out.push_back('\n');
+			}
+			return out;
+		}
+
+	private:
+		struct Command {
+			char op = 0;
+			size_t first = 0;
+			size_t last = 0;
+			std::vector<std::string_view> text;
+		};
+
+		std::vector<std::unique_ptr<std::string>> storage;
+		std::vector<std::string_view> lines;
+
+		std::string_view keep(std::string text) {
+			storage.push_back(std::make_unique<std::string>(std::move(text)));
+			return *storage.back();
+		}
+
+		static std::vector<std::string_view> splitLines(std::string_view text) {
+			std::vector<std::string_view> result;
+			size_t pos = 0;
+			while (pos < text.size()) {
+				size_t eol = text.find('\n', pos);
+				if (eol == std::string_view::npos) eol = text.size();
+				result.push_back(text.substr(pos, eol - pos));
+				pos = eol + 1;
+			}
+			return result;
+		}
+
+		static Command parseCommand(std::string_view line) {
+			Command command;
+			std::string text(line);
+			char* end = nullptr;
+			command.first = std::strtoull(text.c_str(), &end, 10);
+			command.last = command.first;
+			if (end == text.c_str()) throw std::runtime_error("bad ed command: " + text);
+			if (*end == ',') command.last = std::strtoull(end + 1, &end, 10);
+			command.op = *end;
+			if (end[0] == 0 || end[1] != 0 || (command.op != 'a' && command.op != 'c' && command.op != 'd'))
+				throw std::runtime_error("unsupported ed command: " + text);
+			if (command.op != 'a' && (command.first == 0 || command.last < command.first))
+				throw std::runtime_error("bad ed range: " + text);
+			return command;
+		}
+	};
+};// namespace deb
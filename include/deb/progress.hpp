@@ -0,0 +1,151 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace deb {
+	// Live state of one package, workers update it with plain atomic stores, no lock involved.
+	struct ProgressEntry {
+		enum Phase { Queued, Downloading, Extracting, Done };
+
+		std::string name;
+		std::atomic<uint64_t> bytes{0};
+		std::atomic<uint64_t> total{0};
+		std::atomic<int> phase{Queued};
+	};
+
+	// Set of packages currently being installed. Registration is spread over shards so workers
+	// starting and finishing packages rarely meet on the same mutex, and never on the renderer's.
+	class ProgressTracker {
+	public:
+		struct Snapshot {
+			std::string name;
+			uint64_t bytes = 0;
+			uint64_t total = 0;
+			ProgressEntry::Phase phase = ProgressEntry::Queued;
+		};
+
+		std::shared_ptr<ProgressEntry> begin(const std::string& name, uint64_t total = 0) {
+			auto entry = std::make_shared<ProgressEntry>();
+			entry->name = name;
+			entry->total = total;
+			auto& shard = shardFor(entry.get());
+			std::lock_guard<std::mutex> lock(shard.mtx);
+			shard.entries[entry.get()] = entry;
+			return entry;
+		}
+
+		void end(const std::shared_ptr<ProgressEntry>& entry) {
+			entry->phase = ProgressEntry::Done;
+			auto& shard = shardFor(entry.get());
+			std::lock_guard<std::mutex> lock(shard.mtx);
+			shard.entries.erase(entry.get());
+		}
+
+		std::vector<Snapshot> snapshot() {
+			std::vector<Snapshot> result;
+			for (auto& shard : shards) {
+				std::lock_guard<std::mutex> lock(shard.mtx);
+				for (auto& [ptr, entry] : shard.entries) {
+					result.push_back({entry->name, entry->bytes, entry->total, ProgressEntry::Phase(entry->phase.load())});
+				}
+			}
+			return result;
+		}
+
+	private:
+		struct Shard {
+			std::mutex mtx;
+			std::unordered_map<const ProgressEntry*, std::shared_ptr<ProgressEntry>> entries;
+		};
+		std::array<Shard, 16> shards;
+
+		Shard& shardFor(const ProgressEntry* entry) { return shards[(std::hash<const void*>{}(entry) >> 4) % shards.size()]; }
+	};
+
+	// Background thread that snapshots a ProgressTracker a few times per second and hands it to draw,
+	// keeping terminal output off the workers' path entirely.
+	class ProgressRenderer {
+	public:
+		ProgressRenderer(
+			ProgressTracker& tracker,
+			std::function<void(const std::vector<ProgressTracker::Snapshot>&)> draw,
+			std::chrono::milliseconds interval = std::chrono::milliseconds(250)
+		) :
+			tracker(tracker), draw(draw), interval(interval) {
+			thread = std::thread([this] { run(); });
+		}
+		ProgressRenderer(const ProgressRenderer&) = delete;
+		~ProgressRenderer() { stop(); }
+
+		void stop() {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (stopping) return;
+				stopping = true;
+			}
+			cv.notify_all();
+			if (thread.joinable()) thread.join();
+		}
+
+	private:
+		ProgressTracker& tracker;
+		std::function<void(const std::vector<ProgressTracker::Snapshot>&)> draw;
+		std::chrono::milliseconds interval;
+		std::mutex mtx;
+		std::condition_variable cv;
+		bool stopping = false;
+		std::thread thread;
+
+		void run() {
+			std::unique_lock<std::mutex> lock(mtx);
+			while (!stopping) {
+				lock.unlock();
+				draw(tracker.snapshot());
+				lock.lock();
+				cv.wait_for(lock, interval, [&] { return stopping; });
+			}
+			lock.unlock();
+			draw(tracker.snapshot());
+		}
+	};
+};// namespace deb
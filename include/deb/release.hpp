@@ -0,0 +1,119 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <deb/packages-parser.hpp>
+
+namespace deb {
+	// One line of a checksum list ("<sha256> <size> <name>") as found in Release and Packages.diff/Index.
+	struct ChecksumEntry {
+		std::string sha256 = "";
+		uint64_t size = 0;
+		std::string name = "";
+	};
+
+	inline std::vector<ChecksumEntry> parseChecksumList(std::string_view value) {
+		std::vector<ChecksumEntry> result;
+		size_t pos = 0;
+		while (pos < value.size()) {
+			size_t eol = value.find('\n', pos);
+			if (eol == std::string_view::npos) eol = value.size();
+			std::string_view line = value.substr(pos, eol - pos);
+			pos = eol + 1;
+
+			std::string_view fields[3];
+			size_t count = 0;
+			size_t i = 0;
+			while (count < 3 && i < line.size()) {
+				while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) i++;
+				size_t start = i;
+				while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') i++;
+				if (i > start) fields[count++] = line.substr(start, i - start);
+			}
+			if (count != 3) continue;
+			ChecksumEntry entry;
+			entry.sha256 = std::string(fields[0]);
+			entry.size = std::stoull(std::string(fields[1]));
+			entry.name = std::string(fields[2]);
+			result.push_back(std::move(entry));
+		}
+		return result;
+	}
+
+	// The SHA256 file list of a distribution's InRelease / Release file. The signature of InRelease is stripped, not checked.
+	class ReleaseFile {
+	public:
+		static ReleaseFile parse(std::string_view text) {
+			const std::string_view signedHeader = "-----BEGIN PGP SIGNED MESSAGE-----";
+			if (text.substr(0, signedHeader.size()) == signedHeader) {
+				// armor headers (Hash: ...) end at the first empty line
+				size_t body = text.find("\n\n");
+				text = body == std::string_view::npos ? std::string_view() : text.substr(body + 2);
+				size_t signature = text.find("\n-----BEGIN PGP SIGNATURE-----");
+				if (signature != std::string_view::npos) text = text.substr(0, signature + 1);
+			}
+
+			ReleaseFile release;
+			for (auto& entry : parseChecksumList(findField(text, "SHA256"))) release.files[entry.name] = entry;
+			return release;
+		}
+
+		// path is relative to dists/<distribution>/, like "main/binary-amd64/Packages"
+		const ChecksumEntry* find(const std::string& path) const {
+			auto it = files.find(path);
+			return it == files.end() ? nullptr : &it->second;
+		}
+
+		// Smallest compressed variant of path the repository lists, empty if there is none.
+		std::string pickVariant(const std::string& path) const {
+			std::string best = "";
+			uint64_t bestSize = UINT64_MAX;
+			for (const char* extension : {".xz", ".zst", ".gz"}) {
+				auto entry = find(path + extension);
+				if (entry && entry->size < bestSize) {
+					best = path + extension;
+					bestSize = entry->size;
+				}
+			}
+			return best;
+		}
+
+		bool empty() const { return files.empty(); }
+
+	private:
+		std::map<std::string, ChecksumEntry> files;
+	};
+};// namespace deb
@@ -0,0 +1,319 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <deb/budget.hpp>
+
+namespace deb {
+	// Fixed set of threads with one deque per worker. Workers run their own newest task first
+	// and steal the oldest task of another worker when they run dry.
+	class WorkStealingPool {
+	public:
+		WorkStealingPool(size_t threadCount) {
+			if (threadCount == 0) threadCount = 1;
+			for (size_t i = 0; i < threadCount; i++) workers.emplace_back(std::make_unique<Worker>());
+			for (size_t i = 0; i < threadCount; i++) threads.emplace_back([this, i] { run(i); });
+		}
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		~WorkStealingPool() {
+			{
+				std::lock_guard<std::mutex> lock(sleepMtx);
+				stopping = true;
+			}
+			sleepCv.notify_all();
+			for (auto& t : threads) t.join();
+		}
+
+		void submit(std::function<void()> task) {
+			size_t target = (currentPool == this) ? currentWorker : next++ % workers.size();
+			{
+				std::lock_guard<std::mutex> lock(workers[target]->mtx);
+				workers[target]->tasks.push_back(std::move(task));
+			}
+			{
+				std::lock_guard<std::mutex> lock(sleepMtx);
+				queued++;
+			}
+			sleepCv.notify_one();
+		}
+
+		size_t size() { return workers.size(); }
+
+	private:
+		struct Worker {
+			std::mutex mtx;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::vector<std::thread> threads;
+		std::atomic_size_t next{0};
+		std::mutex sleepMtx;
+		std::condition_variable sleepCv;
+		size_t queued = 0;
+		bool stopping = false;
+
+		static inline thread_local WorkStealingPool* currentPool = nullptr;
+		static inline thread_local size_t currentWorker = 0;
+
+		bool take(size_t self, std::function<void()>& task) {
+			{
+				auto& own = *workers[self];
+				std::lock_guard<std::mutex> lock(own.mtx);
+				if (!own.tasks.empty()) {
+					task = std::move(own.tasks.back());
+					own.tasks.pop_back();
+					return true;
+				}
+			}
+			for (size_t k = 1; k < workers.size(); k++) {
+				auto& victim = *workers[(self + k) % workers.size()];
+				std::lock_guard<std::mutex> lock(victim.mtx);
+				if (!victim.tasks.empty()) {
+					task = std::move(victim.tasks.front());
+					victim.tasks.pop_front();
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void run(size_t self) {
+			currentPool = this;
+			currentWorker = self;
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lock(sleepMtx);
+					sleepCv.wait(lock, [&] { return stopping || queued > 0; });
+					if (queued == 0) return;// stopping and drained
+					queued--;
+				}
+				// a task is reserved for us, it may just not be visible in any deque yet
+				std::function<void()> task;
+				while (!take(self, task)) std::this_thread::yield();
+				task();
+			}
+		}
+	};
+
+	// Install pipeline executor: a large pool for work that mostly waits on sockets and a core sized
+	// work stealing pool for decompression and extraction. Tracks queue depth per stage so a stalled stage is visible.
+	// Several callers can share one Scheduler, each waiting on its own Group.
+	class Scheduler {
+	public:
+		enum Stage { Fetch, Parse, Download, Extract, StageCount };
+
+		// The tasks one caller waits for and the first error among them. Tasks submitted while a group is entered
+		// (see enter()) belong to it, and so does everything they submit. A thread that never entered one uses the
+		// scheduler's default group, which only one such thread at a time may wait on.
+		class Group {
+		public:
+			Group() : state(std::make_shared<State>()) {}
+
+		private:
+			friend class Scheduler;
+			struct State {
+				size_t pending = 0;
+				std::exception_ptr error;
+			};
+			// tasks hold on to it, a caller that leaves without waiting doesn't pull it from under them
+			std::shared_ptr<State> state;
+		};
+
+		// Makes group the one this thread submits to and waits on, until the scope ends.
+		class Scope {
+		public:
+			Scope(Scheduler& scheduler, Group& group) : previous(current) { current = {&scheduler, group.state}; }
+			Scope(const Scope&) = delete;
+			~Scope() { current = previous; }
+
+		private:
+			std::pair<Scheduler*, std::shared_ptr<Group::State>> previous;
+		};
+
+		struct StageStats {
+			const char* name = "";
+			size_t queued = 0;
+			size_t running = 0;
+			size_t completed = 0;
+			size_t peakQueued = 0;
+			double busySeconds = 0;// summed over threads, can exceed wall time
+		};
+
+		Scheduler(size_t ioThreads, size_t cpuThreads) :
+			ioPool(ioThreads), cpuPool(cpuThreads ? cpuThreads : std::max<size_t>(1, std::thread::hardware_concurrency())) {}
+
+		void io(Stage stage, std::function<void()> task) { submit(ioPool, stage, std::move(task)); }
+		void cpu(Stage stage, std::function<void()> task) { submit(cpuPool, stage, std::move(task)); }
+
+		// Runs task on the io pool once budget admits cost. The task gets the lease and keeps it, or hands it on,
+		// for as long as it holds what it was admitted for. Counts as queued in stage while it waits, wait() covers it.
+		void io(Stage stage, Budget& budget, Budget::Cost cost, std::function<void(Budget::Lease)> task) {
+			auto group = currentGroup();
+			auto& c = track(stage, *group);
+			budget.admit(cost, [this, stage, &c, group, task = std::move(task)](Budget::Lease lease) {
+				c.queued--;
+				// admitted on whichever thread released the room, the group is passed on explicitly
+				submit(ioPool, stage, group, [task, lease] { task(lease); });
+				std::lock_guard<std::mutex> lock(waitMtx);
+				group->pending--;// submit() has counted the task itself by now, this never reaches 0
+			});
+		}
+
+		Scope enter(Group& group) { return Scope(*this, group); }
+
+		// Blocks until every task of the current group, including the ones they submitted, has finished.
+		// Rethrows the first exception any of them threw. Must not be called from a pool thread.
+		void wait() {
+			auto group = currentGroup();
+			std::unique_lock<std::mutex> lock(waitMtx);
+			waitCv.wait(lock, [&] { return group->pending == 0; });
+			if (group->error) {
+				auto e = group->error;
+				group->error = nullptr;
+				std::rethrow_exception(e);
+			}
+		}
+
+		std::vector<StageStats> stats() {
+			static const char* names[] = {"fetch", "parse", "download", "extract"};
+			std::vector<StageStats> result;
+			for (size_t i = 0; i < StageCount; i++) {
+				StageStats s;
+				s.name = names[i];
+				s.queued = counters[i].queued;
+				s.running = counters[i].running;
+				s.completed = counters[i].completed;
+				s.peakQueued = counters[i].peakQueued;
+				s.busySeconds = counters[i].busyNanos / 1e9;
+				result.push_back(s);
+			}
+			return result;
+		}
+
+		std::string statsReport() {
+			std::stringstream ss;
+			for (auto& s : stats()) {
+				if (s.completed == 0 && s.running == 0 && s.queued == 0) continue;
+				ss << s.name << ": " << s.completed << " done, " << s.running << " running, " << s.queued
+				   << " queued, peak queue " << s.peakQueued << "\n";
+			}
+			return ss.str();
+		}
+
+		size_t ioThreads() { return ioPool.size(); }
+		size_t cpuThreads() { return cpuPool.size(); }
+
+	private:
+		struct Counters {
+			std::atomic_size_t queued{0};
+			std::atomic_size_t running{0};
+			std::atomic_size_t completed{0};
+			std::atomic_size_t peakQueued{0};
+			std::atomic_uint64_t busyNanos{0};
+		};
+
+		std::array<Counters, StageCount> counters;
+		// guards the pending and error of every group
+		std::mutex waitMtx;
+		std::condition_variable waitCv;
+		Group defaultGroup;
+		// declared last so their threads are joined before anything they touch is destroyed
+		WorkStealingPool ioPool;
+		WorkStealingPool cpuPool;
+
+		// the group entered on this thread, or the one of the task it is running
+		static inline thread_local std::pair<Scheduler*, std::shared_ptr<Group::State>> current;
+
+		std::shared_ptr<Group::State> currentGroup() {
+			return current.first == this ? current.second : defaultGroup.state;
+		}
+
+		// counts one more queued task in stage and keeps the group's wait() from returning until it is done
+		Counters& track(Stage stage, Group::State& group) {
+			{
+				std::lock_guard<std::mutex> lock(waitMtx);
+				group.pending++;
+			}
+			auto& c = counters[stage];
+			size_t depth = ++c.queued;
+			size_t peak = c.peakQueued;
+			while (depth > peak && !c.peakQueued.compare_exchange_weak(peak, depth)) {}
+			return c;
+		}
+
+		void submit(WorkStealingPool& pool, Stage stage, std::function<void()> task) {
+			submit(pool, stage, currentGroup(), std::move(task));
+		}
+
+		void submit(WorkStealingPool& pool, Stage stage, std::shared_ptr<Group::State> group, std::function<void()> task) {
+			auto& c = track(stage, *group);
+			pool.submit([this, &c, group, task = std::move(task)] {
+				c.queued--;
+				c.running++;
+				std::exception_ptr failure;
+				auto start = std::chrono::steady_clock::now();
+				{
+					// what the task submits belongs to its group
+					auto previous = current;
+					current = {this, group};
+					try {
+						task();
+					} catch (...) { failure = std::current_exception(); }
+					current = previous;
+				}
+				auto elapsed = std::chrono::steady_clock::now() - start;
+				c.busyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+				c.running--;
+				c.completed++;
+
+				std::lock_guard<std::mutex> lock(waitMtx);
+				if (failure && !group->error) group->error = failure;
+				if (--group->pending == 0) waitCv.notify_all();
+			});
+		}
+	};
+};// namespace deb
@@ -0,0 +1,502 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <deb/deb-downloader.hpp>
+
+namespace deb {
+	// Keeps one Installer with its parsed index, connections and pipeline alive for many clients on a unix socket.
+	// Lookups and resolutions are answered from the index in memory, also while a refresh or an install runs. The
+	// index is fetched again in the background every refreshInterval and swapped in once it is complete.
+	// Install requests that arrive together form one batch (see Installer::install(const vector<InstallJob>&)), so a
+	// package several clients need is fetched once. Up to maxBatches batches run at the same time, as long as they
+	// install into different destinations. Refreshes run on their own thread and never hold up an install.
+	//
+	// One request per line, any number of them per connection:
+	//   provides <name>                      <package> <version> <url> of the package installed for name
+	//   resolve <package>...                 <package> <url> <sha256> <size> for every package of the closure
+	//   install <destination> <package>...   installs the closure into destination, answers once it is done
+	//   refresh                              fetches the index again before answering
+	//   stats                                <key> <value> lines
+	// Every answer ends with a line "ok" or "error <message>".
+	class InstallerService {
+	public:
+		// sources, architecture, caches and the like are set on it before start()
+		Installer installer{nullptr};
+		// the index is fetched again this long after the last refresh, 0 = only on "refresh" requests
+		std::chrono::seconds refreshInterval{600};
+		// install batches running at once, they share the installer's pipeline and connections
+		size_t maxBatches = 4;
+
+		InstallerService() { installer.liveView = false; }
+		InstallerService(const InstallerService&) = delete;
+		InstallerService& operator=(const InstallerService&) = delete;
+		~InstallerService() { stop(); }
+
+		// Builds the index, then listens on socketPath (a stale socket file there is replaced) and returns.
+		void start(const std::filesystem::path& socketPath) {
+			installer.getPackageList();
+			installer.dependencyGraph().compileAll();
+			lastRefresh = Clock::now();
+
+			auto address = socketAddress(socketPath);
+			listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (listenFd < 0) throw std::runtime_error("could not create a unix socket");
+			::unlink(socketPath.c_str());
+			if (::bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(listenFd, 64) != 0) {
+				::close(listenFd);
+				listenFd = -1;
+				throw std::runtime_error("could not listen on " + socketPath.string());
+			}
+			path = socketPath;
+			stopping = false;
+			worker = std::thread([this] { work(); });
+			refresher = std::thread([this] { refreshPeriodically(); });
+			acceptor = std::thread([this] { acceptConnections(); });
+		}
+
+		// Stops accepting, closes every connection and waits for the running installs and refresh to finish.
+		// Installs and refreshes that haven't started fail.
+		void stop() {
+			if (listenFd < 0) return;
+			{
+				// what is still queued fails, so no connection waits for an install that won't run
+				std::lock_guard<std::mutex> lock(jobsMtx);
+				stopping = true;
+				jobsCv.notify_all();
+			}
+			worker.join();
+			refresher.join();
+			{
+				// only the ones still open, the number of a closed one may already belong to another file
+				std::lock_guard<std::mutex> lock(connectionsMtx);
+				for (auto& [id, connection] : connections)
+					if (connection.fd >= 0) ::shutdown(connection.fd, SHUT_RDWR);
+			}
+			::shutdown(listenFd, SHUT_RDWR);
+			acceptor.join();
+			::close(listenFd);
+			listenFd = -1;
+			// nothing adds connections anymore, serve() only changes the fd of its own under the lock
+			for (auto& [id, connection] : connections) connection.thread.join();
+			connections.clear();
+			finished.clear();
+			::unlink(path.c_str());
+		}
+
+		// The answer to one request line, what a connection sends back for every line it reads.
+		std::string handle(const std::string& line) {
+			std::stringstream in(line);
+			std::string command;
+			in >> command;
+			std::vector<std::string> args;
+			for (std::string arg; in >> arg;) args.push_back(arg);
+
+			requestCount++;
+			std::stringstream out;
+			try {
+				if (command == "provides" && args.size() == 1) {
+					std::shared_lock<std::shared_mutex> lock(indexMtx);
+					auto& index = installer.packageIndex;
+					auto* pkg = index.find(args[0]);
+					if (!pkg) throw std::runtime_error("no package provides " + args[0]);
+					out << index.str(pkg->name) << " " << index.str(pkg->version) << " " << index.url(*pkg) << "\n";
+				} else if (command == "resolve" && !args.empty()) {
+					// the dependency graph was compiled in full when the index was swapped in, resolutions only read
+					std::shared_lock<std::shared_mutex> lock(indexMtx);
+					for (auto& planned : installer.resolve(args, installer.recursionLimit, preInstalledUrls())) {
+						std::string sha256 = planned.sha256.empty() ? "-" : planned.sha256;
+						out << planned.name << " " << planned.url << " " << sha256 << " " << planned.size << "\n";
+					}
+				} else if (command == "install" && args.size() >= 2) {
+					InstallJob job{"", {{"./", args[0]}}};
+					for (size_t i = 1; i < args.size(); i++) job.packages += (i > 1 ? " " : "") + args[i];
+					out << enqueueInstall(job).get();
+				} else if (command == "refresh" && args.empty()) {
+					out << enqueueRefresh().get();
+				} else if (command == "stats" && args.empty()) {
+					std::shared_lock<std::shared_mutex> lock(indexMtx);
+					auto age = std::chrono::duration<double>(Clock::now() - lastRefresh.load()).count();
+					out << "packages " << installer.packageIndex.packagesSize() << "\n"
+						<< "requests " << requestCount << "\n"
+						<< "refreshes " << refreshCount << "\n"
+						<< "index_age_seconds " << age << "\n"
+						<< "installs " << installCount << "\n"
+						<< "install_batches " << batchCount << "\n"
+						<< "running_batches " << runningBatches << "\n";
+				} else {
+					throw std::runtime_error("bad request: " + line);
+				}
+			} catch (std::exception& e) {
+				std::string message = e.what();
+				std::replace(message.begin(), message.end(), '\n', ' ');
+				return "error " + message + "\n";
+			}
+			return out.str() + "ok\n";
+		}
+
+		static sockaddr_un socketAddress(const std::filesystem::path& socketPath) {
+			sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+			if (socketPath.string().size() >= sizeof(address.sun_path))
+				throw std::runtime_error("socket path too long: " + socketPath.string());
+			std::strcpy(address.sun_path, socketPath.c_str());
+			return address;
+		}
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		struct PendingInstall {
+			InstallJob job;
+			std::promise<std::string> done;
+		};
+
+		// guards the installer's index, lookups and resolutions share it and only a refresh swapping in a new index
+		// takes it exclusively
+		std::shared_mutex indexMtx;
+		std::atomic<Clock::time_point> lastRefresh{Clock::now()};
+		std::atomic_size_t requestCount{0};
+		std::atomic_size_t refreshCount{0};
+		std::atomic_size_t installCount{0};
+		std::atomic_size_t batchCount{0};
+		std::atomic_size_t runningBatches{0};
+
+		// work for the worker and the refresher, guarded by jobsMtx
+		std::mutex jobsMtx;
+		std::condition_variable jobsCv;
+		std::vector<PendingInstall> installs;
+		std::vector<std::promise<std::string>> refreshes;
+		std::thread worker;
+		std::thread refresher;
+		// running batches by id, the ones in finishedBatches have returned and are joined by the worker
+		std::map<size_t, std::thread> batches;
+		std::vector<size_t> finishedBatches;
+		size_t nextBatch = 0;
+		// destinations a running batch installs into
+		std::set<std::string> busyDestinations;
+
+		std::filesystem::path path;
+		int listenFd = -1;
+		std::thread acceptor;
+		struct Connection {
+			int fd = -1;// -1 once serve() closed it
+			std::thread thread;
+		};
+
+		// one thread per connection by id, the ones in finished have returned and are joined by the acceptor.
+		// Ids rather than fds, a closed fd's number is reused by the next accept()
+		std::mutex connectionsMtx;
+		std::map<size_t, Connection> connections;
+		std::vector<size_t> finished;
+		size_t nextConnection = 0;
+		std::atomic_bool stopping{false};
+
+		// Every request resolves from the pre-installed packages only. What earlier requests installed went to their
+		// own destinations and doesn't count.
+		std::set<std::string> preInstalledUrls() {
+			std::set<std::string> urls;
+			for (auto& pkg : installer.preInstalled) {
+				if (installer.packageIndex.count(pkg)) urls.insert(installer.packageIndex.url(pkg));
+			}
+			return urls;
+		}
+
+		std::future<std::string> enqueueInstall(const InstallJob& job) {
+			std::lock_guard<std::mutex> lock(jobsMtx);
+			if (stopping) throw std::runtime_error("service is stopping");
+			installs.push_back({job, {}});
+			jobsCv.notify_all();
+			return installs.back().done.get_future();
+		}
+
+		std::future<std::string> enqueueRefresh() {
+			std::lock_guard<std::mutex> lock(jobsMtx);
+			if (stopping) throw std::runtime_error("service is stopping");
+			refreshes.emplace_back();
+			jobsCv.notify_all();
+			return refreshes.back().get_future();
+		}
+
+		static bool touches(const PendingInstall& pending, const std::set<std::string>& destinations) {
+			for (auto& location : pending.job.locations)
+				if (destinations.count(location.second)) return true;
+			return false;
+		}
+
+		// Starts a batch of everything queued whenever a slot is free, leaving out installs into a destination a
+		// running batch writes to. Those wait for it and go into the next batch.
+		void work() {
+			std::unique_lock<std::mutex> lock(jobsMtx);
+			auto startable = [&] {
+				if (batches.size() >= std::max<size_t>(maxBatches, 1)) return false;
+				for (auto& pending : installs)
+					if (!touches(pending, busyDestinations)) return true;
+				return false;
+			};
+			while (true) {
+				jobsCv.wait(lock, [&] { return stopping || !finishedBatches.empty() || startable(); });
+				for (size_t id : finishedBatches) {
+					batches[id].join();
+					batches.erase(id);
+				}
+				finishedBatches.clear();
+				if (stopping) break;
+				if (!startable()) continue;
+
+				std::vector<PendingInstall> batch;
+				std::set<std::string> destinations;
+				for (auto it = installs.begin(); it != installs.end();) {
+					if (touches(*it, busyDestinations)) {
+						++it;
+						continue;
+					}
+					for (auto& location : it->job.locations) destinations.insert(location.second);
+					batch.push_back(std::move(*it));
+					it = installs.erase(it);
+				}
+				busyDestinations.insert(destinations.begin(), destinations.end());
+				size_t id = nextBatch++;
+				batches[id] = std::thread([this, id, destinations, batch = std::move(batch)]() mutable {
+					runningBatches++;
+					runBatch(batch);
+					runningBatches--;
+					std::lock_guard<std::mutex> lock(jobsMtx);
+					for (auto& destination : destinations) busyDestinations.erase(destination);
+					finishedBatches.push_back(id);
+					jobsCv.notify_all();
+				});
+			}
+			auto error = std::make_exception_ptr(std::runtime_error("service is stopping"));
+			for (auto& pending : installs) pending.done.set_exception(error);
+			installs.clear();
+			// running batches finish, they need jobsMtx to report back
+			auto running = std::move(batches);
+			batches.clear();
+			lock.unlock();
+			for (auto& [id, thread] : running) thread.join();
+		}
+
+		// Runs requested refreshes and the periodic one, apart from the installs.
+		void refreshPeriodically() {
+			std::unique_lock<std::mutex> lock(jobsMtx);
+			while (true) {
+				auto ready = [&] { return stopping || !refreshes.empty(); };
+				bool periodic = refreshInterval.count() > 0;
+				if (periodic) jobsCv.wait_until(lock, lastRefresh.load() + refreshInterval, ready);
+				else
+					jobsCv.wait(lock, ready);
+				if (stopping) break;
+				if (refreshes.empty() && !(periodic && Clock::now() >= lastRefresh.load() + refreshInterval)) continue;
+
+				auto waiting = std::move(refreshes);
+				refreshes.clear();
+				lock.unlock();
+				std::string result;
+				std::exception_ptr error;
+				try {
+					result = refresh();
+				} catch (...) { error = std::current_exception(); }
+				for (auto& promise : waiting) error ? promise.set_exception(error) : promise.set_value(result);
+				lock.lock();
+			}
+			auto error = std::make_exception_ptr(std::runtime_error("service is stopping"));
+			for (auto& promise : refreshes) promise.set_exception(error);
+			refreshes.clear();
+		}
+
+		// Fetches the index while the old one keeps answering, then swaps it in. A failed refresh keeps the old one.
+		std::string refresh() {
+			// counted as an attempt, a failing mirror is retried after refreshInterval and not in a loop
+			lastRefresh = Clock::now();
+			auto list = installer.fetchPackageList();
+			size_t packages = list.index.packagesSize();
+			{
+				std::unique_lock<std::shared_mutex> lock(indexMtx);
+				installer.usePackageList(std::move(list));
+				installer.dependencyGraph().compileAll();
+			}
+			refreshCount++;
+			return "packages " + std::to_string(packages) + "\n";
+		}
+
+		void runBatch(std::vector<PendingInstall>& batch) {
+			std::vector<InstallJob> jobs;
+			for (auto& pending : batch) jobs.push_back(pending.job);
+			Lockfile lockfile;
+			try {
+				{
+					std::shared_lock<std::shared_mutex> lock(indexMtx);
+					ResolutionReport resolution;
+					lockfile = installer.resolveLockfile(jobs, preInstalledUrls(), resolution);
+				}
+				installer.installPinned(lockfile);
+			} catch (...) {
+				for (auto& pending : batch) pending.done.set_exception(std::current_exception());
+				return;
+			}
+			batchCount++;
+			installCount += batch.size();
+			for (auto& pending : batch) {
+				size_t packages = 0;
+				for (auto& [key, package] : lockfile.packages) {
+					for (auto& location : pending.job.locations) packages += package.locations.count(location);
+				}
+				pending.done.set_value("packages " + std::to_string(packages) + "\n");
+			}
+		}
+
+		void acceptConnections() {
+			while (true) {
+				int fd = ::accept(listenFd, nullptr, nullptr);
+				std::lock_guard<std::mutex> lock(connectionsMtx);
+				for (size_t done : finished) {
+					connections[done].thread.join();
+					connections.erase(done);
+				}
+				finished.clear();
+				if (fd < 0 && errno == EINTR && !stopping) continue;
+				if (fd < 0) return;// shut down by stop()
+				if (stopping) {
+					::close(fd);
+					return;
+				}
+				size_t id = nextConnection++;
+				connections[id] = {fd, std::thread([this, id, fd] { serve(id, fd); })};
+			}
+		}
+
+		void serve(size_t id, int fd) {
+			std::string buffer;
+			char chunk[4096];
+			bool open = true;
+			while (open) {
+				ssize_t n = ::read(fd, chunk, sizeof(chunk));
+				if (n <= 0) break;
+				buffer.append(chunk, n);
+				size_t start = 0, eol;
+				while (open && (eol = buffer.find('\n', start)) != std::string::npos) {
+					std::string line = buffer.substr(start, eol - start);
+					start = eol + 1;
+					if (!line.empty() && line.back() == '\r') line.pop_back();
+					if (!line.empty()) open = sendAll(fd, handle(line));
+				}
+				buffer.erase(0, start);
+			}
+			std::lock_guard<std::mutex> lock(connectionsMtx);
+			// stop() joins it right away, otherwise the acceptor does on its next connection
+			if (!stopping) finished.push_back(id);
+			// marked before the number is given up, stop() never shuts down whatever reuses it
+			connections[id].fd = -1;
+			::close(fd);
+		}
+
+		static bool sendAll(int fd, const std::string& data) {
+			size_t sent = 0;
+			while (sent < data.size()) {
+				ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) return false;
+				sent += n;
+			}
+			return true;
+		}
+	};
+
+	// A connection to an InstallerService, one request at a time.
+	class ServiceClient {
+	public:
+		ServiceClient(const std::filesystem::path& socketPath) {
+			auto address = InstallerService::socketAddress(socketPath);
+			fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd < 0 || ::connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+				if (fd >= 0) ::close(fd);
+				throw std::runtime_error("could not connect to " + socketPath.string());
+			}
+		}
+		ServiceClient(const ServiceClient&) = delete;
+		ServiceClient& operator=(const ServiceClient&) = delete;
+		~ServiceClient() { ::close(fd); }
+
+		// The lines of the answer to line without the final "ok", an "error" answer is thrown with its message.
+		std::vector<std::string> request(const std::string& line) {
+			std::string data = line + "\n";
+			size_t sent = 0;
+			while (sent < data.size()) {
+				ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) throw std::runtime_error("connection to the service lost");
+				sent += n;
+			}
+
+			std::vector<std::string> lines;
+			while (true) {
+				size_t eol;
+				while ((eol = buffer.find('\n')) == std::string::npos) {
+					char chunk[4096];
+					ssize_t n = ::read(fd, chunk, sizeof(chunk));
+					if (n < 0 && errno == EINTR) continue;
+					if (n <= 0) throw std::runtime_error("connection to the service lost");
+					buffer.append(chunk, n);
+				}
+				std::string answer = buffer.substr(0, eol);
+				buffer.erase(0, eol + 1);
+				if (answer == "ok") return lines;
+				if (answer.rfind("error ", 0) == 0) throw std::runtime_error(answer.substr(6));
+				lines.push_back(answer);
+			}
+		}
+
+	private:
+		int fd = -1;
+		std::string buffer;
+	};
+};// namespace deb
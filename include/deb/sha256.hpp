@@ -0,0 +1,78 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <openssl/evp.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace deb {
+	// Incremental SHA256 (libcrypto), fed chunk by chunk as data streams past.
+	class Sha256 {
+	public:
+		Sha256() {
+			ctx = EVP_MD_CTX_new();
+			if (!ctx || EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1) throw std::runtime_error("sha256 init failed");
+		}
+		Sha256(const Sha256&) = delete;
+		Sha256& operator=(const Sha256&) = delete;
+		~Sha256() { EVP_MD_CTX_free(ctx); }
+
+		void update(const char* data, size_t size) {
+			if (EVP_DigestUpdate(ctx, data, size) != 1) throw std::runtime_error("sha256 update failed");
+		}
+
+		// lowercase hex digest, the form Packages files use
+		std::string hex() {
+			unsigned char digest[EVP_MAX_MD_SIZE];
+			unsigned int size = 0;
+			if (EVP_DigestFinal_ex(ctx, digest, &size) != 1) throw std::runtime_error("sha256 final failed");
+			static const char* digits = "0123456789abcdef";
+			std::string result;
+			result.reserve(size * 2);
+			for (unsigned int i = 0; i < size; i++) {
+				result += digits[digest[i] >> 4];
+				result += digits[digest[i] & 0xf];
+			}
+			return result;
+		}
+
+		static std::string of(std::string_view data) {
+			Sha256 h;
+			h.update(data.data(), data.size());
+			return h.hex();
+		}
+
+	private:
+		EVP_MD_CTX* ctx = nullptr;
+	};
+};// namespace deb
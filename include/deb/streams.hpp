@@ -0,0 +1,169 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+
+namespace deb {
+	// Read-only streambuf over memory the caller owns, lets bxz/tar readers consume a buffer without copying it into a stringstream.
+	class MemoryStreambuf : public std::streambuf {
+	public:
+		MemoryStreambuf(const char* data, size_t size) {
+			char* begin = const_cast<char*>(data);
+			setg(begin, begin, begin + size);
+		}
+
+	protected:
+		pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+			if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+			off_type base = 0;
+			if (dir == std::ios_base::cur) base = gptr() - eback();
+			else if (dir == std::ios_base::end)
+				base = egptr() - eback();
+			return seekpos(pos_type(base + off), which);
+		}
+
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+			if (!(which & std::ios_base::in) || off_type(pos) < 0 || off_type(pos) > egptr() - eback())
+				return pos_type(off_type(-1));
+			setg(eback(), eback() + off_type(pos), egptr());
+			return pos;
+		}
+
+		std::streamsize xsgetn(char* s, std::streamsize n) override {
+			std::streamsize available = egptr() - gptr();
+			if (n > available) n = available;
+			if (n > 0) {
+				std::memcpy(s, gptr(), n);
+				setg(eback(), gptr() + n, egptr());
+			}
+			return n;
+		}
+
+		std::streamsize showmanyc() override { return egptr() - gptr(); }
+	};
+
+	class imemstream : public std::istream {
+	public:
+		imemstream(const char* data, size_t size) : std::istream(nullptr), buf(data, size) { rdbuf(&buf); }
+		imemstream(const std::string& str) : imemstream(str.data(), str.size()) {}
+
+	private:
+		MemoryStreambuf buf;
+	};
+
+	// Bounded single producer / single consumer byte pipe. One thread write()s chunks as they arrive (an http body callback),
+	// another reads them through an istream. The writer blocks once `capacity` bytes are queued.
+	class PipeStreambuf : public std::streambuf {
+	public:
+		PipeStreambuf(size_t capacity = 4 << 20) : capacity(capacity) {}
+
+		// Returns false once the reader gave up, the writer should stop producing then.
+		bool write(const char* data, size_t size) {
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&] { return cancelled || queued == 0 || queued + size <= capacity; });
+			if (cancelled) return false;
+			chunks.emplace_back(data, size);
+			queued += size;
+			total += size;
+			cv.notify_all();
+			return true;
+		}
+
+		void close() {
+			std::lock_guard<std::mutex> lock(mtx);
+			closed = true;
+			cv.notify_all();
+		}
+
+		void fail(std::exception_ptr e) {
+			std::lock_guard<std::mutex> lock(mtx);
+			if (cancelled) return;// the writer only failed because the reader stopped listening
+			error = e;
+			closed = true;
+			cv.notify_all();
+		}
+
+		// reader side, unblocks and stops the writer
+		void cancel() {
+			std::lock_guard<std::mutex> lock(mtx);
+			cancelled = true;
+			chunks.clear();
+			queued = 0;
+			cv.notify_all();
+		}
+
+		// the reader only sees eof, this tells a truncated transfer apart from a complete one
+		void rethrowIfFailed() {
+			std::lock_guard<std::mutex> lock(mtx);
+			if (error) std::rethrow_exception(error);
+		}
+
+		size_t written() {
+			std::lock_guard<std::mutex> lock(mtx);
+			return total;
+		}
+
+	protected:
+		int_type underflow() override {
+			if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&] { return !chunks.empty() || closed || cancelled; });
+			if (chunks.empty()) return traits_type::eof();
+			current = std::move(chunks.front());
+			chunks.pop_front();
+			queued -= current.size();
+			cv.notify_all();
+			char* begin = current.data();
+			setg(begin, begin, begin + current.size());
+			return traits_type::to_int_type(*gptr());
+		}
+
+	private:
+		size_t capacity;
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::deque<std::string> chunks;
+		std::string current;
+		size_t queued = 0;
+		size_t total = 0;
+		bool closed = false;
+		bool cancelled = false;
+		std::exception_ptr error;
+	};
+};// namespace deb
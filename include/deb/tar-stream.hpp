@@ -0,0 +1,183 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <string>
+
+#include <deb/ar-stream.hpp>
+
+namespace deb {
+	// Sequential tar reader (ustar, GNU long names, pax path/size overrides) that hands out each entry's
+	// contents as a stream. Used where the installer needs to see every entry itself instead of tar::Reader.
+	class TarStreamReader {
+	public:
+		struct Entry {
+			enum Type { File, Directory, Symlink, Hardlink, Other };
+
+			std::string name;// as stored, usually "./usr/..."
+			Type type = Other;
+			uint32_t mode = 0;
+			uint64_t size = 0;
+			std::string linkTarget;
+		};
+
+		TarStreamReader(std::istream& in) : in(in), contentStream(nullptr) { contentStream.rdbuf(&content); }
+
+		// Moves to the next entry, skipping the unread part of the current one. Returns false at the end of the archive.
+		bool next(Entry& result) {
+			std::string longName, longLink;
+			while (true) {
+				finishCurrent();
+
+				char header[512];
+				in.read(header, 512);
+				if (in.gcount() == 0) return false;
+				if (in.gcount() != 512) throw std::runtime_error("Truncated tar header");
+				// two zero blocks end the archive, one is enough to know nothing follows
+				if (header[0] == 0) return false;
+
+				uint64_t size = parseNumber(header + 124, 12);
+				char type = header[156];
+				startEntry(size);
+
+				// metadata entries describe the entry that follows them
+				if (type == 'L' || type == 'K') {
+					std::string value = readContent(size);
+					value = value.substr(0, value.find('\0'));
+					(type == 'L' ? longName : longLink) = value;
+					continue;
+				}
+				if (type == 'x') {
+					parsePax(readContent(size), longName, longLink, paxSize);
+					continue;
+				}
+				if (type == 'g') continue;
+
+				result = Entry{};
+				if (!longName.empty()) result.name = longName;
+				else {
+					std::string prefix = field(header + 345, 155);
+					result.name = field(header, 100);
+					if (!prefix.empty() && std::memcmp(header + 257, "ustar", 5) == 0) result.name = prefix + "/" + result.name;
+				}
+				result.linkTarget = longLink.empty() ? field(header + 157, 100) : longLink;
+				result.mode = uint32_t(parseNumber(header + 100, 8));
+				if (paxSize != UINT64_MAX) {
+					size = paxSize;
+					paxSize = UINT64_MAX;
+					startEntry(size);
+				}
+				result.size = size;
+				switch (type) {
+					case '0':
+					case '\0':
+					case '7': result.type = Entry::File; break;
+					case '5': result.type = Entry::Directory; break;
+					case '2': result.type = Entry::Symlink; break;
+					case '1': result.type = Entry::Hardlink; break;
+					default: result.type = Entry::Other;
+				}
+				return true;
+			}
+		}
+
+		// contents of the entry returned by the last next()
+		std::istream& stream() { return contentStream; }
+
+	private:
+		std::istream& in;
+		LimitedStreambuf content;
+		std::istream contentStream;
+		uint64_t padding = 0;
+		uint64_t paxSize = UINT64_MAX;
+
+		void startEntry(uint64_t size) {
+			content.reset(in.rdbuf(), size);
+			contentStream.clear();
+			padding = (512 - size % 512) % 512;
+		}
+
+		void finishCurrent() {
+			content.skipRest();
+			if (padding) in.ignore(padding);
+			padding = 0;
+			content.reset(in.rdbuf(), 0);
+		}
+
+		std::string readContent(uint64_t size) {
+			std::string value(size, '\0');
+			contentStream.read(value.data(), size);
+			if (uint64_t(contentStream.gcount()) != size) throw std::runtime_error("Truncated tar entry");
+			return value;
+		}
+
+		static std::string field(const char* data, size_t size) { return std::string(data, strnlen(data, size)); }
+
+		// octal, or base-256 with the high bit set for sizes that don't fit
+		static uint64_t parseNumber(const char* data, size_t size) {
+			if ((unsigned char)data[0] & 0x80) {
+				uint64_t value = (unsigned char)data[0] & 0x7f;
+				for (size_t i = 1; i < size; i++) value = (value << 8) | (unsigned char)data[i];
+				return value;
+			}
+			uint64_t value = 0;
+			for (size_t i = 0; i < size && data[i]; i++) {
+				if (data[i] == ' ') continue;
+				if (data[i] < '0' || data[i] > '7') break;
+				value = value * 8 + (data[i] - '0');
+			}
+			return value;
+		}
+
+		// records are "<length> <key>=<value>\n"
+		static void parsePax(const std::string& data, std::string& path, std::string& linkpath, uint64_t& size) {
+			size_t pos = 0;
+			while (pos < data.size()) {
+				size_t space = data.find(' ', pos);
+				if (space == std::string::npos) break;
+				size_t length = std::stoull(data.substr(pos, space - pos));
+				if (length == 0 || pos + length > data.size()) break;
+				std::string record = data.substr(space + 1, pos + length - space - 2);
+				pos += length;
+				size_t eq = record.find('=');
+				if (eq == std::string::npos) continue;
+				std::string key = record.substr(0, eq), value = record.substr(eq + 1);
+				if (key == "path") path = value;
+				else if (key == "linkpath")
+					linkpath = value;
+				else if (key == "size")
+					size = std::stoull(value);
+			}
+		}
+	};
+};// namespace deb
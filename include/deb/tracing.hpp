@@ -0,0 +1,323 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace deb {
+	// Records what every thread spent its time on during an install, as spans per package and phase plus a few
+	// counters. Off by default: a disabled tracer hands out empty spans without reading the clock.
+	// Export as Chrome trace-event JSON (chrome://tracing, Perfetto) or as a summary table.
+	class Tracer {
+	public:
+		enum Counter {
+			IndexBytes,
+			BytesDownloaded,
+			BytesDecompressed,
+			Packages,
+			FilesWritten,
+			FilesUnchanged,
+			CounterCount
+		};
+
+		std::atomic_bool enabled{false};
+
+		class Span {
+		public:
+			Span() {}
+			Span(Tracer* tracer, const char* phase, std::string detail) :
+				tracer(tracer), phase(phase), detail(std::move(detail)), start(tracer->now()) {}
+			Span(const Span&) = delete;
+			Span(Span&& other) :
+				tracer(other.tracer), phase(other.phase), detail(std::move(other.detail)), start(other.start) {
+				other.tracer = nullptr;
+			}
+			Span& operator=(Span&& other) {
+				end();
+				tracer = other.tracer;
+				phase = other.phase;
+				detail = std::move(other.detail);
+				start = other.start;
+				other.tracer = nullptr;
+				return *this;
+			}
+			~Span() { end(); }
+
+			void end() {
+				if (!tracer) return;
+				tracer->record(phase, std::move(detail), start, tracer->now() - start);
+				tracer = nullptr;
+			}
+
+		private:
+			Tracer* tracer = nullptr;
+			const char* phase = "";
+			std::string detail;
+			uint64_t start = 0;
+		};
+
+		Tracer() : origin(std::chrono::steady_clock::now()) {}
+		Tracer(const Tracer&) = delete;
+
+		// phase must be a string literal, it is stored as a pointer
+		Span span(const char* phase, const std::string& detail = "") {
+			if (!enabled) return Span();
+			return Span(this, phase, detail);
+		}
+
+		void count(Counter counter, uint64_t amount) {
+			if (enabled) counters[counter] += amount;
+		}
+
+		uint64_t counter(Counter counter) { return counters[counter]; }
+
+		void clear() {
+			for (auto& shard : shards) {
+				std::lock_guard<std::mutex> lock(shard.mtx);
+				shard.events.clear();
+			}
+			for (auto& c : counters) c = 0;
+		}
+
+		void writeChromeTrace(const std::string& path) {
+			std::ofstream out(path, std::ios::trunc);
+			out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			bool first = true;
+			uint64_t last = 0;
+			for (auto& e : events()) {
+				out << (first ? "" : ",\n") << "{\"name\":\"" << e.phase
+					<< "\",\"cat\":\"deb\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread << ",\"ts\":" << e.start
+					<< ",\"dur\":" << e.duration << ",\"args\":{\"detail\":\"" << escape(e.detail) << "\"}}";
+				first = false;
+				last = std::max(last, e.start + e.duration);
+			}
+			for (size_t c = 0; c < CounterCount; c++) {
+				out << (first ? "" : ",\n") << "{\"name\":\"" << counterNames()[c]
+					<< "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << last << ",\"args\":{\"value\":" << counters[c] << "}}";
+				first = false;
+			}
+			out << "\n]}\n";
+			if (!out) throw std::runtime_error("could not write trace to " + path);
+		}
+
+		// Time per phase summed over all threads, so phases that overlap can add up to more than the wall time.
+		std::string summary() {
+			struct Row {
+				size_t count = 0;
+				uint64_t total = 0;
+				uint64_t max = 0;
+			};
+			std::map<std::string, Row> rows;
+			for (auto& e : events()) {
+				auto& row = rows[e.phase];
+				row.count++;
+				row.total += e.duration;
+				row.max = std::max(row.max, e.duration);
+			}
+
+			std::stringstream ss;
+			char line[160];
+			snprintf(
+				line, sizeof(line), "%-18s %8s %12s %10s %10s\n", "phase", "spans", "total ms", "mean ms", "max ms"
+			);
+			ss << line;
+			for (auto& [phase, row] : rows) {
+				snprintf(
+					line, sizeof(line), "%-18s %8zu %12.1f %10.2f %10.2f\n", phase.c_str(), row.count, row.total / 1e3,
+					row.total / 1e3 / row.count, row.max / 1e3
+				);
+				ss << line;
+			}
+			for (size_t c = 0; c < CounterCount; c++) ss << counterNames()[c] << ": " << counters[c] << "\n";
+			return ss.str();
+		}
+
+	private:
+		struct Event {
+			const char* phase;
+			std::string detail;
+			uint32_t thread;
+			uint64_t start;// microseconds since the tracer was created
+			uint64_t duration;
+		};
+		struct Shard {
+			std::mutex mtx;
+			std::vector<Event> events;
+		};
+
+		std::chrono::steady_clock::time_point origin;
+		std::array<Shard, 16> shards;
+		std::array<std::atomic_uint64_t, CounterCount> counters{};
+
+		static const char** counterNames() {
+			static const char* names[] = {
+				"index bytes",
+				"bytes downloaded",
+				"bytes decompressed",
+				"packages",
+				"files written",
+				"files unchanged",
+			};
+			return names;
+		}
+
+		static uint32_t threadId() {
+			static std::atomic_uint32_t next{1};
+			thread_local uint32_t id = next++;
+			return id;
+		}
+
+		uint64_t now() {
+			auto elapsed = std::chrono::steady_clock::now() - origin;
+			return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+		}
+
+		// threads record into the shard of their id, so two workers only share a mutex when the ids collide mod 16
+		void record(const char* phase, std::string detail, uint64_t start, uint64_t duration) {
+			uint32_t thread = threadId();
+			auto& shard = shards[thread % shards.size()];
+			std::lock_guard<std::mutex> lock(shard.mtx);
+			shard.events.push_back({phase, std::move(detail), thread, start, duration});
+		}
+
+		std::vector<Event> events() {
+			std::vector<Event> result;
+			for (auto& shard : shards) {
+				std::lock_guard<std::mutex> lock(shard.mtx);
+				result.insert(result.end(), shard.events.begin(), shard.events.end());
+			}
+			std::sort(result.begin(), result.end(), [](auto& a, auto& b) { return a.start < b.start; });
+			return result;
+		}
+
+		static std::string escape(const std::string& s) {
+			std::string out;
+			for (char c : s) {
+				if (c == '"' || c == '\\') out += '\\';
+				if ((unsigned char)c < 0x20) continue;
+				out += c;
+			}
+			return out;
+		}
+	};
+
+	// Pass-through streambuf that traces the reads it forwards, wrapped around a decoder it separates
+	// decompression time from the tar writes that consume it. Given the WaitStreambuf the decoder reads its
+	// input through, the time spent waiting on that input is cut out of the phase.
+	class TracedStreambuf : public std::streambuf {
+	public:
+		TracedStreambuf(std::streambuf* inner, Tracer& tracer, const char* phase, std::string detail) :
+			inner(inner), tracer(tracer), phase(phase), detail(std::move(detail)), buffer(1 << 20) {}
+
+		// the span of the read in progress is closed while its input is waited for, and reopened after
+		void pause() { span.end(); }
+		void resume() {
+			if (reading) span = tracer.span(phase, detail);
+		}
+
+	protected:
+		int_type underflow() override {
+			if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+			reading = true;
+			span = tracer.span(phase, detail);
+			std::streamsize n = inner->sgetn(buffer.data(), buffer.size());
+			span.end();
+			reading = false;
+			if (n <= 0) return traits_type::eof();
+			tracer.count(Tracer::BytesDecompressed, n);
+			setg(buffer.data(), buffer.data(), buffer.data() + n);
+			return traits_type::to_int_type(*gptr());
+		}
+
+	private:
+		std::streambuf* inner;
+		Tracer& tracer;
+		const char* phase;
+		std::string detail;
+		std::vector<char> buffer;
+		Tracer::Span span;
+		bool reading = false;
+	};
+
+	// Pass-through streambuf for a decoder's input that records the reads it forwards as "wait": the pipe from
+	// the download or the disk, not the decoder. Pauses the TracedStreambuf it interrupts meanwhile.
+	class WaitStreambuf : public std::streambuf {
+	public:
+		WaitStreambuf(std::streambuf* source, Tracer& tracer, std::string detail) :
+			source(source), tracer(tracer), detail(std::move(detail)), buffer(1 << 16) {}
+
+		void interrupts(TracedStreambuf* decoder) { this->decoder = decoder; }
+
+	protected:
+		int_type underflow() override {
+			if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+			std::streamsize n = read(buffer.data(), buffer.size());
+			if (n <= 0) return traits_type::eof();
+			setg(buffer.data(), buffer.data(), buffer.data() + n);
+			return traits_type::to_int_type(*gptr());
+		}
+
+		// decoders read their input in large blocks, forwarded as one read instead of one per buffer
+		std::streamsize xsgetn(char* s, std::streamsize count) override {
+			std::streamsize buffered = std::min<std::streamsize>(count, egptr() - gptr());
+			std::copy(gptr(), gptr() + buffered, s);
+			gbump(int(buffered));
+			if (buffered == count) return count;
+			return buffered + std::max<std::streamsize>(read(s + buffered, count - buffered), 0);
+		}
+
+	private:
+		std::streambuf* source;
+		Tracer& tracer;
+		std::string detail;
+		std::vector<char> buffer;
+		TracedStreambuf* decoder = nullptr;
+
+		std::streamsize read(char* s, std::streamsize count) {
+			if (decoder) decoder->pause();
+			auto span = tracer.span("wait", detail);
+			std::streamsize n = source->sgetn(s, count);
+			span.end();
+			if (decoder) decoder->resume();
+			return n;
+		}
+	};
+};// namespace deb
@@ -35,7 +35,7 @@ namespace fs = std::filesystem;
 
 
 
-int main() {
+int main(int argc, char** argv) {
 	deb::Installer inst(
 		{"deb http://packages.linuxmint.com vera main upstream import backport",
 		 "deb http://archive.ubuntu.com/ubuntu jammy main restricted universe multiverse",
@@ -47,15 +47,17 @@ int main() {
 	);
 	inst.recursionLimit = 3;
 	inst.throwOnFailedDependency = true;
-	inst.install("qtbase5-dev qtchooser qt5-qmake qtbase5-dev-tools", "../deb/qt");
+	for (int i = 1; i < argc; i++)
+		if (string(argv[i]) == "--dependency-savings") inst.reportDependencySavings = true;
 	//inst.install("libboost-all-dev", "../deb/boost");
-	inst.install(
-		"libboost-all-dev",
-		{
-			{"./usr/lib/x86_64-linux-gnu", "../deb/boost-lib"},
-			{"./usr/include", "../deb/boost-include"},
-		}
-	);
+	inst.install({
+		{"qtbase5-dev qtchooser qt5-qmake qtbase5-dev-tools", {{"./", "../deb/qt"}}},
+		{"libboost-all-dev",
+		 {
+			 {"./usr/lib/x86_64-linux-gnu", "../deb/boost-lib"},
+			 {"./usr/include", "../deb/boost-include"},
+		 }},
+	});
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Behaviour of the http layer against a local server: `make check`.
+
+#include <deb/deb-downloader.hpp>
+
+#include "../bench/repo-server.hpp"
+#include "../bench/synthetic-repo.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+	void check(bool condition, const string& what) {
+		if (!condition) throw runtime_error(what);
+	}
+
+	string payload(size_t size) {
+		string body(size, '\0');
+		for (size_t i = 0; i < size; i++) body[i] = char('a' + (i * 7 + i / 4096) % 26);
+		return body;
+	}
+
+	// Sequential requests to one host go over the connection the first one opened.
+	void leasedConnectionIsReused() {
+		map<string, string> files = {{"a", payload(1000)}, {"b", payload(200000)}};
+		bench::RepoServer server(files);
+		deb::ConnectionPool pool;
+		for (size_t i = 0; i < 10; i++) {
+			string name = i % 2 ? "b" : "a";
+			string body = deb::downloadString(pool, server.url() + "/" + name);
+			check(body == files[name], "body of request " + to_string(i));
+		}
+		check(server.requests() == 10, "server saw " + to_string(server.requests()) + " requests, expected 10");
+		check(pool.requests() == 10, "pool leased " + to_string(pool.requests()) + " times, expected 10");
+		check(server.connections() == 1, "server saw " + to_string(server.connections()) + " connections, expected 1");
+	}
+
+	// A connection leased out while the pool is cleared is closed when it comes back, not handed to the next request.
+	void clearedLeaseIsClosed() {
+		map<string, string> files = {{"a", payload(1000)}};
+		bench::RepoServer server(files);
+		deb::ConnectionPool pool;
+		{
+			auto client = pool.acquire(server.url());
+			auto res = client->Get("/a");
+			check(res && res->body == files["a"], "body of the leased request");
+			pool.clear();
+		}
+		check(deb::downloadString(pool, server.url() + "/a") == files["a"], "body after clear()");
+		check(server.connections() == 2, "server saw " + to_string(server.connections()) + " connections, expected 2");
+	}
+
+	// A body cut off halfway is completed with a Range request for the rest, the sink sees every byte once.
+	void droppedDownloadResumes() {
+		map<string, string> files = {{"warmup", "x"}, {"big.deb", payload(1 << 20)}};
+		bench::RepoServer server(files);
+		// every second request dies halfway, the first one is the warm-up so the download itself is cut
+		server.dropEvery = 2;
+		deb::ConnectionPool pool;
+		check(deb::downloadString(pool, server.url() + "/warmup") == "x", "warm-up request");
+
+		string received;
+		deb::downloadResumable(pool, server.url() + "/big.deb", 0, 0, [&](const char* data, size_t size) {
+			received.append(data, size);
+			return true;
+		});
+		check(server.dropped() == 1, "server dropped " + to_string(server.dropped()) + " responses, expected 1");
+		check(server.requests() == 3, "server saw " + to_string(server.requests()) + " requests, expected 3");
+		check(received == files["big.deb"], "resumed body differs, " + to_string(received.size()) + " bytes");
+		// a restart from zero would have sent the first half twice
+		check(server.bytesSent() < files["big.deb"].size() * 5 / 4, "the retry started over instead of resuming");
+	}
+
+	// A warm run against an unchanged repository revalidates its InRelease with one conditional GET, answered by a
+	// 304, and takes Packages from the cache by the hash InRelease lists for it.
+	void indexCacheRevalidates() {
+		bench::RepoConfig config;
+		config.packages = 50;
+		config.filesPerDeb = 1;
+		config.debSize = 1 << 10;
+		bench::SyntheticRepo repo(config);
+		bench::RepoServer server(repo.files);
+		auto cacheDirectory = fs::temp_directory_path() / ("deb-test-cache-" + to_string(getpid()));
+		fs::remove_all(cacheDirectory);
+		auto run = [&]() {
+			deb::Installer installer(nullptr);
+			installer.setSources({"deb " + server.url() + " " + config.distribution + " " + config.component});
+			installer.architecture = config.architecture;
+			installer.indexCacheDirectory = cacheDirectory;
+			installer.liveView = false;
+			installer.getPackageList();
+		};
+
+		run();
+		size_t coldRequests = server.requests();
+		size_t coldBytes = server.bytesSent();
+		check(server.notModified() == 0, "the cold run was answered with a 304");
+		run();
+		fs::remove_all(cacheDirectory);
+		size_t warmRequests = server.requests() - coldRequests;
+		check(warmRequests == 1, "the warm run made " + to_string(warmRequests) + " requests, expected 1");
+		check(server.notModified() == 1, to_string(server.notModified()) + " answers were 304, expected 1");
+		check(server.bytesSent() == coldBytes, "the warm run transferred a body");
+	}
+};// namespace
+
+int main() {
+	vector<pair<string, void (*)()>> tests = {
+		{"leased connection is reused", leasedConnectionIsReused},
+		{"cleared lease is closed", clearedLeaseIsClosed},
+		{"dropped download resumes", droppedDownloadResumes},
+		{"index cache revalidates", indexCacheRevalidates},
+	};
+	size_t failed = 0;
+	for (auto& [name, test] : tests) {
+		try {
+			test();
+			cout << "ok      " << name << "\n";
+		} catch (exception& e) {
+			cout << "FAILED  " << name << ": " << e.what() << "\n";
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
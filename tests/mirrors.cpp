@@ -0,0 +1,120 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Mirror selection and hedged requests against two local servers: `make check`.
+
+#include <deb/deb-downloader.hpp>
+
+#include "../bench/repo-server.hpp"
+
+using namespace std;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+	void check(bool condition, const string& what) {
+		if (!condition) throw runtime_error(what);
+	}
+
+	// The same file on two servers, linked as mirrors once both have the latency samples a percentile needs.
+	struct TwoMirrors {
+		map<string, string> files = {{"pool/a.deb", string(64 << 10, 'a')}};
+		bench::RepoServer slow{files}, fast{files};
+		deb::MirrorSet mirrors;
+		deb::Scheduler scheduler{4, 1};
+		deb::ConnectionPool pool;
+
+		TwoMirrors(std::chrono::milliseconds slowLatency, std::chrono::milliseconds fastLatency) {
+			slow.latency = slowLatency;
+			fast.latency = fastLatency;
+			pool.mirrors = &mirrors;
+			pool.scheduler = &scheduler;
+			for (size_t i = 0; i < mirrors.minSamples; i++) {
+				download(slow.url());
+				download(fast.url());
+			}
+			mirrors.link(slow.url(), fast.url());
+		}
+
+		string download(const string& base) {
+			string body;
+			deb::downloadResumable(pool, base + "/pool/a.deb", 0, 0, [&](const char* data, size_t size) {
+				body.append(data, size);
+				return true;
+			});
+			check(body == files["pool/a.deb"], "body from " + base + " differs");
+			return body;
+		}
+	};
+
+	// Every download goes to the mirror with the lower latency, whichever url it was asked for.
+	void fastMirrorIsPicked() {
+		TwoMirrors servers(std::chrono::milliseconds(30), std::chrono::milliseconds(0));
+		servers.mirrors.hedge = false;
+		size_t slowBefore = servers.slow.requests(), fastBefore = servers.fast.requests();
+		for (size_t i = 0; i < 10; i++) servers.download(servers.slow.url());
+		size_t slowRequests = servers.slow.requests() - slowBefore, fastRequests = servers.fast.requests() - fastBefore;
+		check(slowRequests == 0, "the slow mirror got " + to_string(slowRequests) + " requests, expected 0");
+		check(fastRequests == 10, "the fast mirror got " + to_string(fastRequests) + " requests, expected 10");
+	}
+
+	// A request past the latency percentile of its host is duplicated to the next mirror, which answers first.
+	void hedgedRequestWins() {
+		// the first mirror is the faster one until its next request stalls for a second
+		TwoMirrors servers(std::chrono::milliseconds(0), std::chrono::milliseconds(20));
+		servers.slow.stallEvery = servers.slow.requests() + 1;
+		servers.slow.stallLatency = std::chrono::milliseconds(1000);
+
+		auto start = Clock::now();
+		servers.download(servers.slow.url());
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		check(servers.mirrors.hedges() == 1, to_string(servers.mirrors.hedges()) + " hedges, expected 1");
+		check(servers.mirrors.hedgeWins() == 1, to_string(servers.mirrors.hedgeWins()) + " hedge wins, expected 1");
+		check(seconds < 0.5, "the download waited " + to_string(seconds) + " s on the stalled mirror");
+	}
+};// namespace
+
+int main() {
+	vector<pair<string, void (*)()>> tests = {
+		{"fast mirror is picked", fastMirrorIsPicked},
+		{"hedged request wins", hedgedRequestWins},
+	};
+	size_t failed = 0;
+	for (auto& [name, test] : tests) {
+		try {
+			test();
+			cout << "ok      " << name << "\n";
+		} catch (exception& e) {
+			cout << "FAILED  " << name << ": " << e.what() << "\n";
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
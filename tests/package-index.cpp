@@ -0,0 +1,118 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// The package index arena and its snapshots: `make check`.
+
+#include <deb/package-index.hpp>
+
+#include <iostream>
+#include <iterator>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+	void check(bool condition, const string& what) {
+		if (!condition) throw runtime_error(what);
+	}
+
+	deb::PackageIndex build() {
+		deb::PackageIndex index;
+		auto prefix = index.addPrefix("http://deb.example.org/debian");
+		for (auto name : {"app", "tool"}) {
+			string stanza = string("Package: ") + name + "\nVersion: 2.36-9\nDepends: libc6 (>= 2.34)\n" +
+							"Filename: pool/" + name + ".deb\nSize: 100\n";
+			check(index.addStanza(prefix, stanza), string("stanza of ") + name + " was rejected");
+		}
+		return index;
+	}
+
+	string contents(const fs::path& file) {
+		ifstream in(file, ios::binary);
+		return string(istreambuf_iterator<char>(in), {});
+	}
+
+	// A Version or Depends line shared by several packages is kept in the arena once.
+	void repeatedStringsAreStoredOnce() {
+		auto index = build();
+		auto &app = index.package(0), &tool = index.package(1);
+		check(app.version.offset == tool.version.offset, "the shared version was stored twice");
+		check(app.depends.offset == tool.depends.offset, "the shared Depends line was stored twice");
+		check(index.str(tool.depends) == "libc6 (>= 2.34)", "Depends reads back as " + string(index.str(tool.depends)));
+		check(app.name.offset != tool.name.offset, "different names share a string");
+	}
+
+	// Snapshots hold nothing but the index: the same index saves to the same bytes, and one whose references point
+	// past its strings is not mapped.
+	void damagedSnapshotIsRejected() {
+		auto directory = fs::temp_directory_path() / ("deb-test-index-" + to_string(getpid()));
+		fs::remove_all(directory);
+		std::shared_ptr<void> cleanup(nullptr, [&](void*) { fs::remove_all(directory); });
+		build().save(directory / "a.idx", "key");
+		build().save(directory / "b.idx", "key");
+		check(contents(directory / "a.idx") == contents(directory / "b.idx"), "equal indexes saved to different bytes");
+
+		deb::PackageIndex loaded;
+		check(loaded.load(directory / "a.idx", "key"), "the intact snapshot wasn't loaded");
+		check(loaded.url("tool") == "http://deb.example.org/debian/pool/tool.deb", "tool maps to " + loaded.url("tool"));
+
+		// the path of the first package, past the header, the key, the strings and the one prefix
+		string snapshot = contents(directory / "a.idx");
+		auto pad = [](size_t size) { return (size + 7) & ~size_t(7); };
+		uint64_t stringCount;
+		memcpy(&stringCount, snapshot.data() + 16, sizeof(stringCount));
+		size_t path = pad(56) + pad(3) + pad(stringCount) + pad(sizeof(deb::PackageIndex::StringRef)) +
+					  offsetof(deb::PackageIndex::Package, path);
+		uint32_t past = uint32_t(stringCount);
+		memcpy(snapshot.data() + path, &past, sizeof(past));
+		ofstream(directory / "a.idx", ios::binary | ios::trunc) << snapshot;
+		check(!loaded.load(directory / "a.idx", "key"), "a snapshot pointing past its strings was loaded");
+	}
+};// namespace
+
+int main() {
+	vector<pair<string, void (*)()>> tests = {
+		{"repeated strings are stored once", repeatedStringsAreStoredOnce},
+		{"damaged snapshot is rejected", damagedSnapshotIsRejected},
+	};
+	size_t failed = 0;
+	for (auto& [name, test] : tests) {
+		try {
+			test();
+			cout << "ok      " << name << "\n";
+		} catch (exception& e) {
+			cout << "FAILED  " << name << ": " << e.what() << "\n";
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Resolution and lockfiles against a small repository on disk: `make check`.
+
+#include <deb/deb-downloader.hpp>
+
+#include "../bench/synthetic-repo.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+	void check(bool condition, const string& what) {
+		if (!condition) throw runtime_error(what);
+	}
+
+	// A one component repository under a fresh temporary directory, with a Release listing its Packages and, when
+	// given, its Contents-amd64.
+	class LocalRepo {
+	public:
+		fs::path root = fs::temp_directory_path() / ("deb-test-" + to_string(getpid()));
+
+		LocalRepo(const string& packages, const string& contents = "") {
+			fs::remove_all(root);
+			string release = "Origin: test\nSuite: test\nSHA256:\n";
+			auto list = [&](const string& path, const string& content) {
+				string xz = bench::compress("xz", content);
+				release += " " + deb::Sha256::of(content) + " " + to_string(content.size()) + " " + path + "\n";
+				release += " " + deb::Sha256::of(xz) + " " + to_string(xz.size()) + " " + path + ".xz\n";
+				write("dists/test/" + path, content);
+				write("dists/test/" + path + ".xz", xz);
+			};
+			list("main/binary-amd64/Packages", packages);
+			if (!contents.empty()) list("main/Contents-amd64", contents);
+			write("dists/test/Release", release);
+		}
+		LocalRepo(const LocalRepo&) = delete;
+		~LocalRepo() { fs::remove_all(root); }
+
+		void write(const string& path, const string& content) {
+			fs::create_directories((root / path).parent_path());
+			std::ofstream(root / path, std::ios::binary) << content;
+		}
+
+		void configure(deb::Installer& installer) {
+			installer.setSources({"deb file://" + root.string() + " test main"});
+			installer.architecture = "binary-amd64";
+			installer.liveView = false;
+			installer.getPackageList();
+		}
+	};
+
+	string stanza(const string& name, const string& fields = "") {
+		return "Package: " + name + "\nVersion: 1.0\n" + fields + "Filename: pool/" + name +
+			   ".deb\nSize: 100\nSHA256: " + deb::Sha256::of(name) + "\n\n";
+	}
+
+	// A .deb reached through a Provides alias in one job and by its own name in another is locked once, by its name.
+	void aliasAndNameLockOnce() {
+		LocalRepo repo(stanza("app", "Depends: libc-dev\n") + stanza("libc6-dev", "Provides: libc-dev\n"));
+		deb::Installer installer(nullptr);
+		repo.configure(installer);
+
+		auto plan = installer.resolve({"app"}, installer.recursionLimit, std::set<string>{});
+		check(plan.size() == 2 && plan[1].name == "libc6-dev", "the alias was planned as " + plan.back().name);
+
+		auto lockfile = installer.resolveLockfile({
+			{"app", {{"./", "/tmp/dest"}}},
+			{"libc6-dev", {{"./usr/include", "/tmp/dest"}}},
+		});
+		check(lockfile.packages.size() == 2, to_string(lockfile.packages.size()) + " locked packages, expected 2");
+		auto& libc = lockfile.packages.at(deb::Sha256::of("libc6-dev"));
+		check(libc.name == "libc6-dev", "locked under " + libc.name);
+		check(libc.locations.size() == 2, "the locations of both jobs weren't merged");
+	}
+
+	// Contents lists packages by their own name, one reached through Provides is kept when it has files to extract.
+	void contentsKeepProvidedPackages() {
+		LocalRepo repo(
+			stanza("app", "Depends: libc-dev\n") + stanza("libc6-dev", "Provides: libc-dev\n"),
+			"usr/bin/app\tdevel/app\nusr/include/stdio.h\tlibdevel/libc6-dev\n"
+		);
+		deb::Installer installer(nullptr);
+		repo.configure(installer);
+		installer.pruneWithContents = true;
+
+		auto lockfile = installer.resolveLockfile({{"app", {{"./usr/include", "/tmp/dest"}}}});
+		check(lockfile.packages.size() == 1, to_string(lockfile.packages.size()) + " locked packages, expected 1");
+		check(lockfile.packages.begin()->second.name == "libc6-dev", "kept " + lockfile.packages.begin()->second.name);
+	}
+};// namespace
+
+int main() {
+	vector<pair<string, void (*)()>> tests = {
+		{"alias and name lock once", aliasAndNameLockOnce},
+		{"contents keep provided packages", contentsKeepProvidedPackages},
+	};
+	size_t failed = 0;
+	for (auto& [name, test] : tests) {
+		try {
+			test();
+			cout << "ok      " << name << "\n";
+		} catch (exception& e) {
+			cout << "FAILED  " << name << ": " << e.what() << "\n";
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Alex Tarasov
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// The installer service on a unix socket, against a repository on a local server: `make check`.
+
+#include <deb/service.hpp>
+
+#include "../bench/repo-server.hpp"
+#include "../bench/synthetic-repo.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+	void check(bool condition, const string& what) {
+		if (!condition) throw runtime_error(what);
+	}
+
+	// Sends line and returns every line of the answer up to and including the final "ok" or "error ...".
+	vector<string> ask(int fd, const string& line) {
+		string data = line + "\n";
+		check(::send(fd, data.data(), data.size(), MSG_NOSIGNAL) == ssize_t(data.size()), "could not send " + line);
+		vector<string> lines;
+		string buffer;
+		while (lines.empty() || (lines.back() != "ok" && lines.back().rfind("error ", 0) != 0)) {
+			size_t eol;
+			while ((eol = buffer.find('\n')) == string::npos) {
+				char chunk[4096];
+				ssize_t n = ::read(fd, chunk, sizeof(chunk));
+				check(n > 0, "the service closed the connection during " + line);
+				buffer.append(chunk, n);
+			}
+			lines.push_back(buffer.substr(0, eol));
+			buffer.erase(0, eol + 1);
+		}
+		check(buffer.empty(), "the service answered " + line + " with more than one answer");
+		return lines;
+	}
+
+	vector<string> fields(const string& line) {
+		stringstream ss(line);
+		vector<string> result;
+		for (string field; ss >> field;) result.push_back(field);
+		return result;
+	}
+
+	// One request of each kind over one connection, every answer ends with its own "ok" or "error" line.
+	void requestsAreAnswered() {
+		bench::RepoConfig config;
+		config.packages = 20;
+		config.filesPerDeb = 1;
+		config.debSize = 1 << 10;
+		bench::SyntheticRepo repo(config);
+		bench::RepoServer server(repo.files);
+		auto work = fs::temp_directory_path() / ("deb-test-service-" + to_string(getpid()));
+		fs::remove_all(work);
+		fs::create_directories(work);
+		std::shared_ptr<void> cleanup(nullptr, [&](void*) { fs::remove_all(work); });
+
+		deb::InstallerService service;
+		service.installer.setSources({"deb " + server.url() + " " + config.distribution + " " + config.component});
+		service.installer.architecture = config.architecture;
+		service.refreshInterval = std::chrono::seconds(0);
+		service.start(work / "service.sock");
+
+		auto address = deb::InstallerService::socketAddress(work / "service.sock");
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		check(fd >= 0 && ::connect(fd, (sockaddr*)&address, sizeof(address)) == 0, "could not connect");
+		std::shared_ptr<void> closeFd(nullptr, [&](void*) { ::close(fd); });
+
+		auto provides = ask(fd, "provides bench-pkg0");
+		check(provides.size() == 2 && provides[1] == "ok", "provides answered " + provides[0]);
+		auto provided = fields(provides[0]);
+		check(provided.size() == 3 && provided[0] == "bench-pkg0" && provided[1] == "1.0", "provides: " + provides[0]);
+		check(provided[2].rfind(server.url() + "/pool/", 0) == 0, "provides a url off the server: " + provided[2]);
+
+		auto unknown = ask(fd, "provides no-such-package");
+		check(unknown.size() == 1 && unknown[0].rfind("error ", 0) == 0, "unknown package answered " + unknown[0]);
+
+		auto resolved = ask(fd, "resolve bench-pkg0");
+		check(resolved.size() >= 2 && resolved.back() == "ok", "resolve didn't end with ok");
+		check(fields(resolved[0]).size() == 4 && fields(resolved[0])[0] == "bench-pkg0", "resolve: " + resolved[0]);
+		for (size_t i = 0; i + 1 < resolved.size(); i++)
+			check(fields(resolved[i]).size() == 4, "resolve line without 4 fields: " + resolved[i]);
+		size_t closure = resolved.size() - 1;
+
+		auto installed = ask(fd, "install " + (work / "root").string() + " bench-pkg0");
+		check(installed.size() == 2 && installed[1] == "ok", "install answered " + installed[0]);
+		check(installed[0] == "packages " + to_string(closure), "install: " + installed[0]);
+		check(fs::is_regular_file(work / "root/usr/share/bench-pkg0/file0"), "bench-pkg0 wasn't extracted");
+
+		size_t requests = server.requests();
+		auto refreshed = ask(fd, "refresh");
+		check(refreshed.size() == 2 && refreshed[1] == "ok", "refresh answered " + refreshed[0]);
+		check(refreshed[0] == "packages " + to_string(config.packages), "refresh: " + refreshed[0]);
+		check(server.requests() > requests, "refresh didn't go to the server");
+
+		auto bad = ask(fd, "frobnicate");
+		check(bad.size() == 1 && bad[0] == "error bad request: frobnicate", "bad request answered " + bad[0]);
+		service.stop();
+	}
+};// namespace
+
+int main() {
+	vector<pair<string, void (*)()>> tests = {
+		{"requests are answered", requestsAreAnswered},
+	};
+	size_t failed = 0;
+	for (auto& [name, test] : tests) {
+		try {
+			test();
+			cout << "ok      " << name << "\n";
+		} catch (exception& e) {
+			cout << "FAILED  " << name << ": " << e.what() << "\n";
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}